@@ -0,0 +1,35 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+import sys, pathlib
+sys.path.append(str(pathlib.Path(__file__).resolve().parents[1]))
+
+from m1n1.setup import *
+import argparse
+
+parser = argparse.ArgumentParser(description='Measure proxy readmem/writemem throughput')
+parser.add_argument('-s', '--size', type=lambda x: int(x, 0), default=32 << 20,
+                    help='total bytes to transfer in each direction')
+parser.add_argument('-b', '--block', type=lambda x: int(x, 0), default=1 << 20,
+                    help='bytes per readmem/writemem call')
+args = parser.parse_args()
+
+block = args.block
+count = max(1, args.size // block)
+
+buf = u.malloc(block)
+data = os.urandom(block)
+
+def bench(name, fn):
+    t = time.time()
+    for i in range(count):
+        fn()
+    dt = time.time() - t
+    total = count * block
+    print(f"{name}: {total} bytes in {dt:.3f}s, {total / dt / (1 << 20):.2f} MB/s")
+
+bench("writemem", lambda: iface.writemem(buf, data))
+bench("readmem", lambda: iface.readmem(buf, block))
+
+assert iface.readmem(buf, block) == data
+
+u.free(buf)
@@ -1,5 +1,5 @@
 # SPDX-License-Identifier: MIT
-import itertools, fnmatch, sys
+import itertools, fnmatch, struct, sys
 from construct import *
 import sys
 
@@ -434,6 +434,23 @@ def build_prop(path, name, v, t=None):
 
     return t.build(v)
 
+def parse_raw_node(data, offset=0):
+    """Split the node header at offset into {name: (value, is_template)}, without decoding the
+    values. Returns (properties, child_count, offset of the first child)."""
+    pcount, ccount = struct.unpack_from("<II", data, offset)
+    offset += 8
+    raw = {}
+    for i in range(pcount):
+        name = bytes(data[offset:offset + 32]).rstrip(b"\0").decode("ascii")
+        size, = struct.unpack_from("<I", data, offset + 32)
+        vlen = size & 0x7fffffff
+        if offset + 36 + vlen > len(data):
+            raise ValueError(f"Property {name} at {offset:#x} overruns the ADT")
+        raw[name] = (bytes(data[offset + 36:offset + 36 + vlen]), bool(size & 0x80000000))
+        offset += (36 + vlen + 3) & ~3
+
+    return raw, ccount, offset
+
 class ADTNode:
     def __init__(self, val=None, path="/", parent=None):
         self._children = []
@@ -450,32 +467,62 @@ class ADTNode:
             else:
                 raise ValueError(f"Node in {path} has no name!")
 
-            path = self._parent_path + _name
-
-            raw = {}
-            for p in val.properties:
-                raw[p.name] = p.value
-                is_template = bool(p.size & 0x80000000)
-                try:
-                    t, v = parse_prop(self, path, _name, p.name, p.value, is_template)
-                    self._types[p.name] = t, is_template
-                    self._properties[p.name] = v
-                except Exception as e:
-                    print(f"Exception parsing {path}.{p.name} value {p.value.hex()}:", file=sys.stderr)
-                    raise
-
-            # Second pass
-            for k, (t, is_template) in self._types.items():
-                if t is None:
-                    t, v = parse_prop(self, path, _name, k, self._properties[k], is_template)
-                    self._types[k] = t, is_template
-                    self._properties[k] = v
-                    assert build_prop(self._path, k, v, t=t) == raw[k]
+            self._parse_props(self._parent_path + _name, _name,
+                              ((p.name, p.value, bool(p.size & 0x80000000)) for p in val.properties))
 
             for c in val.children:
                 node = ADTNode(c, f"{self._path}/", parent=self)
                 self._children.append(node)
 
+    @classmethod
+    def from_raw(cls, data, offset=0, path="/", parent=None):
+        """Build a node tree from a raw ADT blob without decoding any property.
+
+        Each node keeps its raw property values and only parses them (with the same rules as the
+        eager constructor) the first time its properties are looked at. Returns (node, end).
+        """
+        node = cls.__new__(cls)
+        node.__dict__.update(_children=[], _parent_path=path, _parent=parent)
+
+        raw, ccount, offset = parse_raw_node(data, offset)
+        if "name" not in raw:
+            raise ValueError(f"Node in {path} has no name!")
+        node.__dict__["_raw"] = raw
+        node.__dict__["_name"] = raw["name"][0].decode("ascii").rstrip("\0")
+
+        for i in range(ccount):
+            child, offset = cls.from_raw(data, offset, f"{path}{node._name}/", node)
+            node._children.append(child)
+
+        return node, offset
+
+    def _parse_props(self, path, _name, props):
+        raw = {}
+        for name, value, is_template in props:
+            raw[name] = value
+            try:
+                t, v = parse_prop(self, path, _name, name, value, is_template)
+                self._types[name] = t, is_template
+                self._properties[name] = v
+            except Exception as e:
+                print(f"Exception parsing {path}.{name} value {value.hex()}:", file=sys.stderr)
+                raise
+
+        # Second pass
+        for k, (t, is_template) in self._types.items():
+            if t is None:
+                t, v = parse_prop(self, path, _name, k, self._properties[k], is_template)
+                self._types[k] = t, is_template
+                self._properties[k] = v
+                assert build_prop(self._path, k, v, t=t) == raw[k]
+
+    def _decode(self):
+        raw = self.__dict__.pop("_raw")
+        self._properties = {}
+        self._types = {}
+        self._parse_props(self._parent_path + self._name, self._name,
+                          ((k, v, is_template) for k, (v, is_template) in raw.items()))
+
     @property
     def _path(self):
         return self._parent_path + self.name
@@ -541,6 +588,12 @@ class ADTNode:
         return item in self._children
 
     def __getattr__(self, attr):
+        if "_raw" in self.__dict__:
+            if attr in ("_properties", "_types"):
+                self._decode()
+                return self.__dict__[attr]
+            elif attr == "name":
+                return self._name
         attr = attr.replace("_", "-")
         attr = attr.replace("--", "_")
         if attr in self._properties:
@@ -696,8 +749,32 @@ class ADTNode:
         }
         return data
 
+    def _build_into(self, out):
+        if "_raw" in self.__dict__:
+            props = [(k, v, is_template) for k, (v, is_template) in self._raw.items()]
+        else:
+            props = []
+            for k, v in self._properties.items():
+                t, is_template = self._types.get(k, (None, False))
+                props.append((k, build_prop(self._path, k, v, t=t), is_template))
+
+        out += struct.pack("<II", len(props), len(self._children))
+        for k, value, is_template in props:
+            name = k.encode("ascii")
+            if len(name) > 32:
+                raise ValueError(f"Property name {k!r} in {self._path} is too long")
+            out += name.ljust(32, b"\0")
+            out += struct.pack("<I", len(value) | (0x80000000 if is_template else 0))
+            out += value
+            out += bytes(-len(value) % 4)
+
+        for c in self._children:
+            c._build_into(out)
+
     def build(self):
-        return ADTNodeStruct.build(self.tostruct())
+        out = bytearray()
+        self._build_into(out)
+        return bytes(out)
 
     def walk_tree(self):
         yield self
@@ -736,7 +813,7 @@ class ADTNode:
         return node
 
 def load_adt(data):
-    return ADTNode(ADTNodeStruct.parse(data))
+    return ADTNode.from_raw(data)[0]
 
 if __name__ == "__main__":
     import sys, argparse, pathlib
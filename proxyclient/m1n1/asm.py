@@ -1,5 +1,5 @@
 # SPDX-License-Identifier: MIT
-import os, tempfile, shutil, subprocess, re
+import os, tempfile, shutil, subprocess, re, hashlib, json, struct
 from . import sysreg
 
 __all__ = ["AsmException", "ARMAsm"]
@@ -44,57 +44,270 @@ else:
 class AsmException(Exception):
     pass
 
+_sysreg_re = None
+
+def _sysreg_subst(source):
+    global _sysreg_re
+    if _sysreg_re is None:
+        names = sorted(sysreg.sysreg_fwd, key=len, reverse=True)
+        _sysreg_re = re.compile("\\b(" + "|".join(names) + ")\\b")
+
+    def enc(m):
+        enc = sysreg.sysreg_fwd[m.group(1)]
+        return f"s{enc[0]}_{enc[1]}_c{enc[2]}_c{enc[3]}_{enc[4]}"
+
+    return _sysreg_re.sub(enc, source)
+
+SHT_SYMTAB = 2
+SHT_NOBITS = 8
+STB_LOCAL = 0
+STT_SECTION = 3
+STT_FILE = 4
+
+def _read_elf(path):
+    '''Return the sections {index: (name, addr, data)} and the symbols
+    [(name, bind, type, shndx, value)] of a little-endian ELF64 file'''
+    with open(path, "rb") as fd:
+        elf = fd.read()
+
+    shoff, = struct.unpack_from("<Q", elf, 0x28)
+    shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x3a)
+    shdrs = [struct.unpack_from("<IIQQQQIIQQ", elf, shoff + i * shentsize) for i in range(shnum)]
+
+    def string(table, off):
+        off += shdrs[table][4]
+        return elf[off:elf.index(b"\0", off)].decode("ascii")
+
+    sections = {}
+    symbols = []
+    for i, (name, type, flags, addr, off, size, link, info, align, entsize) in enumerate(shdrs):
+        data = bytes(size) if type == SHT_NOBITS else elf[off:off + size]
+        sections[i] = (string(shstrndx, name), addr, data)
+        if type == SHT_SYMTAB:
+            for p in range(off + entsize, off + size, entsize):
+                st_name, st_info, st_other, st_shndx, st_value, st_size = \
+                    struct.unpack_from("<IBBHQQ", elf, p)
+                symbols.append((string(link, st_name), st_info >> 4, st_info & 0xf, st_shndx,
+                                st_value))
+
+    return sections, symbols
+
 class BaseAsm(object):
+    # Assembled snippets are cached on disk, keyed by source, address and toolchain version.
+    # Set M1N1ASMCACHE= (empty) to disable.
+    CACHE_DIR = os.environ.get("M1N1ASMCACHE",
+        os.path.join(os.environ.get("XDG_CACHE_HOME", os.path.expanduser("~/.cache")), "m1n1", "asm"))
+
+    _toolchain_ids = {}
+
     def __init__(self, source, addr = 0):
         self.source = source
-        self._tmp = tempfile.mkdtemp() + os.sep
+        self._tmp = None
+        self.elffile = None
         self.addr = addr
         self.compile(source)
 
-    def _call(self, program, args):
-        subprocess.check_call(program.replace("%ARCH", self.ARCH) + " " + args, shell=True)
+    def _call(self, program, args, cwd=None):
+        subprocess.check_call(program.replace("%ARCH", self.ARCH) + " " + args, shell=True, cwd=cwd)
 
     def _get(self, program, args):
         return subprocess.check_output(program.replace("%ARCH", self.ARCH) + " " + args, shell=True).decode("ascii")
 
-    def compile(self, source):
-        for name, enc in sysreg.sysreg_fwd.items():
-            source = re.sub("\\b" + name + "\\b", f"s{enc[0]}_{enc[1]}_c{enc[2]}_c{enc[3]}_{enc[4]}", source)
+    def _toolchain_id(self):
+        tools = tuple(t.replace("%ARCH", self.ARCH) for t in (CC, LD, OBJDUMP))
+        if tools not in self._toolchain_ids:
+            ident = list(tools)
+            for tool in tools:
+                try:
+                    ver = subprocess.check_output(tool + " --version", shell=True,
+                                                  stderr=subprocess.DEVNULL)
+                    ident.append(ver.decode("ascii", "replace").split("\n")[0])
+                except (OSError, subprocess.CalledProcessError):
+                    pass
+            self._toolchain_ids[tools] = "\n".join(ident)
+        return self._toolchain_ids[tools]
 
-        self.sfile = self._tmp + "b.S"
-        with open(self.sfile, "w") as fd:
-            fd.write(self.HEADER + "\n")
-            fd.write(source + "\n")
-            fd.write(self.FOOTER + "\n")
+    def _prepare(self, source):
+        self._text = "\n".join((self.HEADER, _sysreg_subst(source), self.FOOTER, ""))
 
-        self.ofile = self._tmp + "b.o"
-        self.elffile = self._tmp + "b.elf"
-        self.bfile = self._tmp + "b.b"
-        self.nfile = self._tmp + "b.n"
-
-        self._call(CC, f"{self.CFLAGS} -c -o {self.ofile} {self.sfile}")
-        self._call(LD, f"{self.LDFLAGS} --Ttext={self.addr:#x} -o {self.elffile} {self.ofile}")
-        self._call(OBJCOPY, f"-j.text -O binary {self.elffile} {self.bfile}")
-        self._call(NM, f"{self.elffile} > {self.nfile}")
-
-        with open(self.bfile, "rb") as fd:
-            self.data = fd.read()
-
-        with open(self.nfile) as fd:
-            for line in fd:
-                line = line.replace("\n", "")
-                addr, type, name = line.split()
-                addr = int(addr, 16)
-                setattr(self, name, addr)
+        h = hashlib.sha256()
+        for part in (self._toolchain_id(), self.CFLAGS, self.LDFLAGS, f"{self.addr:#x}", self._text):
+            h.update(part.encode("utf-8") + b"\0")
+        self.key = h.hexdigest()
+
+    def _cache_path(self, ext):
+        if not self.CACHE_DIR:
+            return None
+        return os.path.join(self.CACHE_DIR, self.key + ext)
+
+    def _cache_load(self, ext):
+        path = self._cache_path(ext)
+        if not path or not os.path.exists(path):
+            return None
+        with open(path) as fd:
+            return fd.read()
+
+    def _cache_store(self, ext, content):
+        path = self._cache_path(ext)
+        if not path:
+            return
+        try:
+            os.makedirs(self.CACHE_DIR, exist_ok=True)
+            with open(f"{path}.{os.getpid()}.tmp", "w") as fd:
+                fd.write(content)
+            os.replace(f"{path}.{os.getpid()}.tmp", path)
+        except OSError as e:
+            print(f"Could not write assembler cache {path}: {e}")
+
+    def _load_cached(self):
+        entry = self._cache_load(".json")
+        if entry is None:
+            return False
+        try:
+            entry = json.loads(entry)
+            self._apply(bytes.fromhex(entry["data"]), entry["symbols"])
+        except (ValueError, KeyError, AttributeError):
+            return False
+        return True
+
+    def _apply(self, data, symbols):
+        self.data = data
+        for name, addr in symbols.items():
+            setattr(self, name, addr)
         self.start = self._start
         self.len = len(self.data)
         self.end = self.start + self.len
 
+    def _build(self, objs, tmp):
+        '''Assemble and link objs in a single compiler and linker run, returning the text and
+        symbols of each. Every snippet's .text gets its own output section at its address.'''
+        script = ["SECTIONS {"]
+        for i, obj in enumerate(objs):
+            with open(f"{tmp}s{i}.S", "w") as fd:
+                # Give each snippet its own entry symbol so that they can be linked together
+                fd.write(f"#define _start _start_{i}\n#line 1\n")
+                fd.write(obj._text)
+            script.append(f"    .text.{i} {obj.addr:#x} : {{ s{i}.o(.text .text.*) }}")
+        script.append("}")
+        with open(tmp + "b.ld", "w") as fd:
+            fd.write("\n".join(script) + "\n")
+
+        # The compiler driver assembles its inputs one after another, so spread them over a
+        # driver per CPU. They all go through a single link.
+        sfiles = [f"s{i}.S" for i in range(len(objs))]
+        njobs = min(os.cpu_count() or 1, len(sfiles))
+        cc = CC.replace("%ARCH", self.ARCH)
+        procs = [subprocess.Popen(f"{cc} {self.CFLAGS} -c {' '.join(sfiles[i::njobs])}",
+                                  shell=True, cwd=tmp) for i in range(njobs)]
+        failed = [p for p in procs if p.wait()]
+        if failed:
+            raise subprocess.CalledProcessError(failed[0].returncode, failed[0].args)
+
+        ofiles = " ".join(f"s{i}.o" for i in range(len(objs)))
+        self._call(LD, f"{self.LDFLAGS} -T b.ld -e _start_0 --no-check-sections -o b.elf {ofiles}",
+                   cwd=tmp)
+
+        sections, symbols = _read_elf(tmp + "b.elf")
+
+        results = [(b"", {}) for obj in objs]
+        snippet = {}
+        for idx, (name, addr, data) in sections.items():
+            if m := re.fullmatch(r"\.text\.(\d+)", name):
+                snippet[idx] = i = int(m.group(1))
+                results[i] = (data, results[i][1])
+
+        # Local symbols follow the STT_FILE symbol of the object that defined them
+        cur = None
+        for name, bind, type, shndx, value in symbols:
+            if type == STT_FILE:
+                m = re.search(r"s(\d+)\.[oS]$", name)
+                cur = int(m.group(1)) if m else None
+                continue
+            if type == STT_SECTION or not name:
+                continue
+            if m := re.fullmatch(r"_start_(\d+)", name):
+                i, name = int(m.group(1)), "_start"
+            elif shndx in snippet:
+                i = snippet[shndx]
+            elif bind == STB_LOCAL and cur is not None:
+                i = cur
+            else:
+                continue
+            results[i][1][name] = value
+
+        return results
+
+    def _store(self, data, symbols):
+        self._cache_store(".json", json.dumps({"data": data.hex(), "symbols": symbols}))
+
+    def compile(self, source):
+        self._prepare(source)
+        if self._load_cached():
+            return
+
+        self._tmp = tempfile.mkdtemp() + os.sep
+        data, symbols = self._build([self], self._tmp)[0]
+        self.elffile = self._tmp + "b.elf"
+        self._store(data, symbols)
+        self._apply(data, symbols)
+
+    @classmethod
+    def batch(cls, snippets):
+        '''Assemble a list of snippets, given as source or (source, addr), with a single
+        toolchain run for all that are not cached yet'''
+        objs = []
+        pending = {}
+        for snippet in snippets:
+            source, addr = (snippet, 0) if isinstance(snippet, str) else snippet
+            obj = cls.__new__(cls)
+            obj.source, obj.addr, obj._tmp, obj.elffile = source, addr, None, None
+            obj._prepare(source)
+            if not obj._load_cached():
+                pending.setdefault(obj.key, []).append(obj)
+            objs.append(obj)
+
+        if not pending:
+            return objs
+
+        groups = list(pending.values())
+        tmp = tempfile.mkdtemp() + os.sep
+        try:
+            results = groups[0][0]._build([g[0] for g in groups], tmp)
+        except subprocess.CalledProcessError:
+            results = None
+        finally:
+            shutil.rmtree(tmp)
+
+        if results is None:
+            # Build them one at a time so the broken snippet is reported on its own
+            for group in groups:
+                for obj in group:
+                    obj.compile(obj.source)
+            return objs
+
+        for group, (data, symbols) in zip(groups, results):
+            group[0]._store(data, symbols)
+            for obj in group:
+                obj._apply(data, symbols)
+
+        return objs
+
+    def _elf(self):
+        # Snippets loaded from the cache or built in a batch are relinked on demand
+        if self.elffile is None:
+            self._tmp = tempfile.mkdtemp() + os.sep
+            self._build([self], self._tmp)
+            self.elffile = self._tmp + "b.elf"
+        return self.elffile
+
     def objdump(self):
-        self._call(OBJDUMP, f"-rd {self.elffile}")
+        self._call(OBJDUMP, f"-rd {self._elf()}")
 
     def disassemble(self):
-        output = self._get(OBJDUMP, f"-zd {self.elffile}")
+        output = self._cache_load(".dis")
+        if output is None:
+            output = re.sub(r"\b_start_0\b", "_start", self._get(OBJDUMP, f"-zd {self._elf()}"))
+            self._cache_store(".dis", output)
 
         for line in output.split("\n"):
             if not line or line.startswith("/"):
@@ -0,0 +1,32 @@
+# SPDX-License-Identifier: MIT
+"""Timing and argument scaffolding shared by the host benchmarks (tools/bench_*.py)."""
+import argparse, time
+
+__all__ = ["parser", "timed", "best_of", "rate", "percentile"]
+
+def parser(description, count, default, help):
+    '''ArgumentParser with the -n/--<count> option every benchmark has'''
+    p = argparse.ArgumentParser(description=description)
+    p.add_argument("-n", f"--{count}", type=int, default=default, help=help)
+    return p
+
+def timed(fn, *args):
+    '''(result, seconds) of a single call'''
+    t = time.perf_counter()
+    ret = fn(*args)
+    return ret, time.perf_counter() - t
+
+def best_of(runs, fn, *args):
+    '''Shortest wall time of fn(*args) over the given number of runs'''
+    return min(timed(fn, *args)[1] for _ in range(max(1, runs)))
+
+def rate(fn, items):
+    '''Calls of fn per second, over one call per item'''
+    t = time.perf_counter()
+    for i in items:
+        fn(i)
+    return len(items) / (time.perf_counter() - t)
+
+def percentile(samples, pct):
+    '''Nearest-rank percentile of an already sorted list'''
+    return samples[min(len(samples) - 1, len(samples) * pct // 100)]
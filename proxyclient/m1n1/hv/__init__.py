@@ -1,5 +1,5 @@
 # SPDX-License-Identifier: MIT
-import io, sys, traceback, struct, array, bisect, os, plistlib, signal, runpy
+import io, sys, traceback, struct, array, os, plistlib, signal, runpy
 from construct import *
 
 from ..asm import ARMAsm
@@ -88,7 +88,7 @@ class HV(Reloadable):
         self._wps = [None, None, None, None]
         self._wpcs = [0, 0, 0, 0]
         self.sym_offset = 0
-        self.symbols = []
+        self.symbols = SymbolIndex()
         self.symbol_dict = {}
         self.sysreg = {0: {}}
         self.novm = False
@@ -626,11 +626,7 @@ class HV(Reloadable):
         if self.xnu_mode and (addr < self.tba.virt_base or unslid_addr < self.macho.vmin):
             return None, None
 
-        idx = bisect.bisect_left(self.symbols, (unslid_addr + 1, "")) - 1
-        if idx < 0 or idx >= len(self.symbols):
-            return None, None
-
-        return self.symbols[idx]
+        return self.symbols.lookup(unslid_addr)
 
     def get_sym(self, addr):
         a, name = self.sym(addr)
@@ -1762,8 +1758,7 @@ class HV(Reloadable):
 
     def _load_macho_symbols(self):
         self.symbol_dict = self.macho.symbols
-        self.symbols = [(v, k) for k, v in self.macho.symbols.items()]
-        self.symbols.sort()
+        self.symbols = SymbolIndex((v, k) for k, v in self.macho.symbols.items())
 
     def load_macho(self, data, symfile=None):
         if isinstance(data, str):
@@ -1828,15 +1823,15 @@ class HV(Reloadable):
         # Assume Linux
         self.sym_offset = 0
         self.xnu_mode = False
-        self.symbols = []
+        symbols = []
         self.symbol_dict = {}
         with open(path) as fd:
             for line in fd.readlines():
                 addr, t, name = line.split()
                 addr = int(addr, 16)
-                self.symbols.append((addr, name))
+                symbols.append((addr, name))
                 self.symbol_dict[name] = addr
-        self.symbols.sort()
+        self.symbols = SymbolIndex(symbols)
 
     def add_kext_symbols(self, kext, demangle=False):
         info_plist = plistlib.load(open(f"{kext}/Contents/Info.plist", "rb"))
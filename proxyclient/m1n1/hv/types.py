@@ -17,19 +17,19 @@ class MMIOTraceFlags(Register32):
     WRITE = 5
     MULTI = 6
 
-EvtMMIOTrace = Struct(
+EvtMMIOTrace = FastStruct(Struct(
     "flags" / RegAdapter(MMIOTraceFlags),
     "reserved" / Int32ul,
     "pc" / Hex(Int64ul),
     "addr" / Hex(Int64ul),
     "data" / Hex(Int64ul),
-)
+))
 
-EvtIRQTrace = Struct(
+EvtIRQTrace = FastStruct(Struct(
     "flags" / Int32ul,
     "type" / Hex(Int16ul),
     "num" / Int16ul,
-)
+))
 
 class HV_EVENT(IntEnum):
     HOOK_VM = 1
@@ -40,12 +40,12 @@ class HV_EVENT(IntEnum):
     VIRTIO = 6
     PANIC = 7
 
-VMProxyHookData = Struct(
+VMProxyHookData = FastStruct(Struct(
     "flags" / RegAdapter(MMIOTraceFlags),
     "id" / Int32ul,
     "addr" / Hex(Int64ul),
     "data" / Array(8, Hex(Int64ul)),
-)
+))
 
 class TraceMode(IntEnum):
     '''
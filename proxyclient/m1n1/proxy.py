@@ -1,5 +1,5 @@
 # SPDX-License-Identifier: MIT
-import platform, os, sys, struct, serial, time
+import platform, os, sys, struct, serial, time, threading, queue, traceback
 from construct import *
 from enum import IntEnum, IntFlag
 from serial.tools.miniterm import Miniterm
@@ -17,6 +17,117 @@ class Serial(serial.Serial):
     def reset_input_buffer(self):
         return
 
+class UsbUnavailable(serial.serialutil.SerialException):
+    pass
+
+class UsbBulkDevice:
+    """Serial-like transport over the m1n1 vendor bulk interface, using pyusb.
+
+    This skips the tty layer entirely and moves data in large bulk transfers.
+    Only the subset of the pyserial API that UartInterface uses is provided."""
+
+    VID = 0x1209
+    PID = 0x316d
+    INTERFACE = 4
+    REQ_SET_READY = 0x01
+    READ_SIZE = 1 << 20
+
+    # writemem() hands this much data to the device at a time
+    write_chunk = 1 << 20
+
+    def __init__(self, serial=None, timeout=3):
+        self.serial = serial
+        self.timeout = timeout
+        self.baudrate = None
+        self.dev = None
+        self.buf = bytearray()
+        self.open()
+
+    def _usb_timeout(self, timeout):
+        # pyusb treats 0 as "wait forever"
+        if timeout is None:
+            return 0
+        return max(1, int(timeout * 1000))
+
+    def open(self):
+        try:
+            import usb.core, usb.util
+        except ImportError:
+            raise UsbUnavailable("pyusb is not installed")
+
+        match = None
+        if self.serial is not None:
+            match = lambda d: usb.util.get_string(d, d.iSerialNumber) == self.serial
+
+        try:
+            dev = usb.core.find(idVendor=self.VID, idProduct=self.PID, custom_match=match)
+            if dev is None:
+                raise UsbUnavailable("no m1n1 USB device found")
+
+            intf = dev.get_active_configuration()[(self.INTERFACE, 0)]
+            try:
+                if dev.is_kernel_driver_active(self.INTERFACE):
+                    dev.detach_kernel_driver(self.INTERFACE)
+            except NotImplementedError:
+                pass
+            usb.util.claim_interface(dev, self.INTERFACE)
+        except KeyError:
+            raise UsbUnavailable("m1n1 on the target has no vendor bulk interface")
+        except usb.core.USBError as e:
+            raise UsbUnavailable(f"cannot open m1n1 USB device: {e}")
+
+        ep_dir = lambda e: usb.util.endpoint_direction(e.bEndpointAddress)
+        self.ep_in = usb.util.find_descriptor(intf,
+            custom_match=lambda e: ep_dir(e) == usb.util.ENDPOINT_IN)
+        self.ep_out = usb.util.find_descriptor(intf,
+            custom_match=lambda e: ep_dir(e) == usb.util.ENDPOINT_OUT)
+
+        self.usb = usb
+        self.dev = dev
+        self.buf = bytearray()
+        self._set_ready(True)
+
+    def _set_ready(self, ready):
+        req_type = self.usb.util.build_request_type(self.usb.util.CTRL_OUT,
+            self.usb.util.CTRL_TYPE_VENDOR, self.usb.util.CTRL_RECIPIENT_INTERFACE)
+        self.dev.ctrl_transfer(req_type, self.REQ_SET_READY, int(ready), self.INTERFACE)
+
+    def close(self):
+        if self.dev is None:
+            return
+        try:
+            self._set_ready(False)
+            self.usb.util.release_interface(self.dev, self.INTERFACE)
+        except self.usb.core.USBError:
+            pass
+        self.usb.util.dispose_resources(self.dev)
+        self.dev = None
+
+    def read(self, size=1):
+        # Always ask for a large block, the transfer ends early on a short packet. Transfers that
+        # are a multiple of the packet size are ended with a ZLP instead, which comes back as an
+        # empty read of its own if the transfer exactly filled the previous request.
+        length = max(self.READ_SIZE, align_up(size, self.ep_in.wMaxPacketSize))
+        for _ in range(2):
+            if self.buf:
+                break
+            try:
+                self.buf += self.ep_in.read(length, self._usb_timeout(self.timeout))
+            except self.usb.core.USBTimeoutError:
+                return b""
+        data = bytes(self.buf[:size])
+        del self.buf[:size]
+        return data
+
+    def write(self, data):
+        return self.ep_out.write(data, self._usb_timeout(self.timeout))
+
+    def flushInput(self):
+        return
+
+    def flushOutput(self):
+        return
+
 class UartError(RuntimeError):
     pass
 
@@ -34,10 +145,11 @@ class UartRemoteError(UartError):
 
 class Feature(IntFlag):
     DISABLE_DATA_CSUMS = 0x01  # Data transfers don't use checksums
+    EXC_INFO = 0x02            # Proxy replies carry exception count and last ESR/FAR
 
     @classmethod
     def get_all(cls):
-        return cls.DISABLE_DATA_CSUMS
+        return cls.DISABLE_DATA_CSUMS | cls.EXC_INFO
 
     def __str__(self):
         return ", ".join(feature.name for feature in self.__class__
@@ -80,7 +192,7 @@ class DART(IntEnum):
     T8110 = 1
     T6000 = 2
 
-ExcInfo = Struct(
+ExcInfo = FastStruct(Struct(
     "regs" / Array(32, Int64ul),
     "spsr" / RegAdapter(SPSR),
     "elr" / Int64ul,
@@ -94,7 +206,7 @@ ExcInfo = Struct(
     "far_phys" / Int64ul,
     "sp_phys" / Int64ul,
     "data" / Int64ul,
-)
+))
 # Sends 56+ byte Commands and Expects 36 Byte Responses
 # Commands are format <I48sI
 #   4 byte command, 48 byte null padded data + 4 byte checksum
@@ -129,6 +241,7 @@ class UartInterface(Reloadable):
 
     CMD_LEN = 56
     REPLY_LEN = 36
+    EXC_INFO_LEN = 24
     EVENT_HDR_LEN = 8
 
     DEFAULT_UART_DEV="/dev/m1n1"
@@ -141,6 +254,14 @@ class UartInterface(Reloadable):
         self.devpath = None
         if device is None:
             device = os.environ.get("M1N1DEVICE", self.DEFAULT_UART_DEV)
+        if isinstance(device, str) and (device == "usb" or device.startswith("usb:")):
+            # Vendor bulk interface, e.g. M1N1DEVICE=usb or usb:<serial>
+            try:
+                device = UsbBulkDevice(device[4:] or None)
+            except UsbUnavailable as e:
+                print(f"USB bulk interface unavailable ({e}), falling back to "
+                      f"{self.DEFAULT_UART_DEV}")
+                device = self.DEFAULT_UART_DEV
         if isinstance(device, str):
             baud = self.DEFAULT_BAUD_RATE
             if ":" in device:
@@ -164,6 +285,10 @@ class UartInterface(Reloadable):
         self.handlers = {}
         self.evt_handlers = {}
         self.enabled_features = Feature(0)
+        self.last_exc = None
+        self._reader = None
+        if os.environ.get("M1N1ASYNC", "0") == "1":
+            self.start_reader()
 
     def checksum(self, data):
         sum = 0xDEADBEEF;
@@ -181,6 +306,13 @@ class UartInterface(Reloadable):
         return self.checksum(data)
 
     def readfull(self, size):
+        if self._reader:
+            # Whatever follows a reply was already received along with it
+            if len(self._trailer) < size:
+                raise UartTimeout("Expected %d bytes, got %d bytes"%(size,len(self._trailer)))
+            d, self._trailer = self._trailer[:size], self._trailer[size:]
+            return d
+
         d = b''
         while len(d) < size:
             block = self.dev.read(size - len(d))
@@ -198,6 +330,8 @@ class UartInterface(Reloadable):
         command += struct.pack("<I", self.checksum(command))
         if self.debug:
             print("<<", hexdump(command))
+        if self._reader and threading.current_thread() is self._evt_worker:
+            raise UartError("Event handlers cannot issue requests while the reader thread runs")
         self.dev.write(command)
 
     def unkhandler(self, s):
@@ -216,6 +350,10 @@ class UartInterface(Reloadable):
         if dev is None:
             dev = self.dev
 
+        reader = self._reader is not None
+        if reader:
+            self.stop_reader()
+
         tout = dev.timeout
         self.tty_enable = True
         dev.timeout = None
@@ -240,8 +378,180 @@ class UartInterface(Reloadable):
 
         dev.timeout = tout
         self.tty_enable = False
+        if reader:
+            self.start_reader()
+
+    def start_reader(self):
+        '''Receive on a background thread from now on.
+
+        The reader splits the stream into replies, which reply() picks up from a queue, and events,
+        which run on a separate worker thread. Event floods then no longer delay replies, and events
+        are decoded while the caller issues its next request. Handlers must not issue requests
+        themselves in this mode. Pending events are always handled before a boot/exception callback.'''
+        if self._reader:
+            return
+        self._replies = queue.Queue()
+        self._events = queue.Queue()
+        self._expect = []
+        self._trailer = b""
+        self._rxbuf = bytearray()
+        self._reader_stop = False
+        self._evt_worker = threading.Thread(target=self._event_loop, name="m1n1-events", daemon=True)
+        self._reader = threading.Thread(target=self._reader_loop, name="m1n1-rx", daemon=True)
+        self._evt_worker.start()
+        self._reader.start()
+
+    def stop_reader(self):
+        if not self._reader:
+            return
+        self._reader_stop = True
+        if hasattr(self.dev, "cancel_read"):
+            self.dev.cancel_read()
+        self._reader.join()
+        self._events.put(None)
+        self._evt_worker.join()
+        self._reader = self._evt_worker = None
+
+    def drain_events(self):
+        if self._reader:
+            self._events.join()
+
+    def _expect_reply(self, cmd, trailer):
+        # Tells the reader how many raw bytes follow the reply to cmd. Requests nest (callbacks
+        # issue their own while the outer one is in flight), so the newest expectation comes first.
+        if self._reader:
+            self._expect.append((cmd, trailer))
+
+    def _rx_fill(self, size):
+        while len(self._rxbuf) < size:
+            if self._reader_stop:
+                raise EOFError()
+            want = max(getattr(self.dev, "in_waiting", 0), size - len(self._rxbuf))
+            self._rxbuf += self.dev.read(want)
+
+    def _rx(self, size):
+        self._rx_fill(size)
+        d = bytes(self._rxbuf[:size])
+        del self._rxbuf[:size]
+        return d
+
+    def _rx_sync(self):
+        while True:
+            i = self._rxbuf.find(b"\xff\x55\xaa")
+            if i >= 0:
+                if i:
+                    self.unkhandler(bytes(self._rxbuf[:i]))
+                    del self._rxbuf[:i]
+                return self._rx(4)
+
+            # Everything but a partial magic at the end is console output
+            keep = 2 if self._rxbuf.endswith(b"\xff\x55") else 1 if self._rxbuf.endswith(b"\xff") else 0
+            if len(self._rxbuf) > keep:
+                self.unkhandler(bytes(self._rxbuf[:len(self._rxbuf) - keep]))
+                del self._rxbuf[:len(self._rxbuf) - keep]
+            self._rx_fill(len(self._rxbuf) + 1)
+
+    def _rx_frame(self):
+        hdr = self._rx_sync()
+        cmdin = struct.unpack("<I", hdr)[0]
+
+        if cmdin == self.REQ_EVENT:
+            hdr += self._rx(self.EVENT_HDR_LEN - 4)
+            data_len, event_type = struct.unpack("<HH", hdr[4:])
+            frame = hdr + self._rx(data_len + 4)
+            if self.debug:
+                print(">>", hexdump(frame))
+            checksum = struct.unpack("<I", frame[-4:])[0]
+            ccsum = self.data_checksum(frame[:-4])
+            if checksum != ccsum:
+                raise UartChecksumError("Event checksum error: Expected 0x%08x, got 0x%08x"%(checksum, ccsum))
+            self._events.put((EVENT(event_type), frame[self.EVENT_HDR_LEN:-4]))
+            return
+
+        frame = hdr + self._rx(self.REPLY_LEN - 4)
+        trailer_len = 0
+        if self._expect and self._expect[-1][0] == cmdin:
+            trailer_len = self._expect.pop()[1]
+        status = struct.unpack("<i", frame[4:8])[0]
+        # The device only sends the trailing data along with a successful reply
+        trailer = self._rx(trailer_len) if status == self.ST_OK else b""
+        self._replies.put((frame, trailer))
+
+    def _reader_loop(self):
+        failed = False
+        while not self._reader_stop:
+            try:
+                self._rx_frame()
+                failed = False
+            except EOFError:
+                break
+            except Exception as e:
+                # Hand the first error of a streak (e.g. a USB disconnect) to the waiting request
+                if not failed:
+                    self._replies.put(e)
+                failed = True
+                self._rxbuf.clear()
+                time.sleep(0.1)
+
+    def _event_loop(self):
+        while True:
+            evt = self._events.get()
+            try:
+                if evt is None:
+                    return
+                self.handle_event(*evt)
+            except Exception:
+                traceback.print_exc()
+            finally:
+                self._events.task_done()
+
+    def _check_reply(self, cmd, reply):
+        # Returns the reply data, or None after a boot/exception callback was handled
+        cmdin, status, data, checksum = struct.unpack("<Ii24sI", reply)
+        ccsum = self.checksum(reply[:-4])
+        if checksum != ccsum:
+            print("Reply checksum error: Expected 0x%08x, got 0x%08x"%(checksum, ccsum))
+            raise UartChecksumError()
+
+        if cmdin != cmd:
+            if cmdin == self.REQ_BOOT and status == self.ST_OK:
+                self.drain_events()
+                self.handle_boot(data)
+                return None
+            raise UartCMDError("Reply command mismatch: Expected 0x%08x, got 0x%08x"%(cmd, cmdin))
+        if status != self.ST_OK:
+            if status == self.ST_BADCMD:
+                raise UartRemoteError("Reply error: Bad Command")
+            elif status == self.ST_INVAL:
+                raise UartRemoteError("Reply error: Invalid argument")
+            elif status == self.ST_XFERERR:
+                raise UartRemoteError("Reply error: Data transfer failed")
+            elif status == self.ST_CSUMERR:
+                raise UartRemoteError("Reply error: Data checksum failed")
+            else:
+                raise UartRemoteError("Reply error: Unknown error (%d)"%status)
+        return data
+
+    def _reply_queued(self, cmd):
+        while True:
+            try:
+                item = self._replies.get(timeout=self.dev.timeout)
+            except queue.Empty:
+                raise UartTimeout("No reply for 0x%08x"%cmd)
+            if isinstance(item, Exception):
+                raise item
+
+            reply, self._trailer = item
+            if self.debug:
+                print(">>", hexdump(reply))
+            data = self._check_reply(cmd, reply)
+            if data is not None:
+                return data
 
     def reply(self, cmd):
+        if self._reader:
+            return self._reply_queued(cmd)
+
         reply = b''
         while True:
             if not reply or reply[-1] != 255:
@@ -280,29 +590,10 @@ class UartInterface(Reloadable):
             reply += self.readfull(self.REPLY_LEN - 4)
             if self.debug:
                 print(">>", hexdump(reply))
-            status, data, checksum = struct.unpack("<i24sI", reply[4:])
-            ccsum = self.checksum(reply[:-4])
-            if checksum != ccsum:
-                print("Reply checksum error: Expected 0x%08x, got 0x%08x"%(checksum, ccsum))
-                raise UartChecksumError()
-
-            if cmdin != cmd:
-                if cmdin == self.REQ_BOOT and status == self.ST_OK:
-                    self.handle_boot(data)
-                    reply = b''
-                    continue
-                raise UartCMDError("Reply command mismatch: Expected 0x%08x, got 0x%08x"%(cmd, cmdin))
-            if status != self.ST_OK:
-                if status == self.ST_BADCMD:
-                    raise UartRemoteError("Reply error: Bad Command")
-                elif status == self.ST_INVAL:
-                    raise UartRemoteError("Reply error: Invalid argument")
-                elif status == self.ST_XFERERR:
-                    raise UartRemoteError("Reply error: Data transfer failed")
-                elif status == self.ST_CSUMERR:
-                    raise UartRemoteError("Reply error: Data checksum failed")
-                else:
-                    raise UartRemoteError("Reply error: Unknown error (%d)"%status)
+            data = self._check_reply(cmd, reply)
+            if data is None:
+                reply = b''
+                continue
             return data
 
     def handle_boot(self, data):
@@ -345,6 +636,10 @@ class UartInterface(Reloadable):
             else:
                 raise UartTimeout("Reconnection timed out")
             print(" Connected")
+            if self._reader:
+                # Drop the errors the reader ran into while the device was gone
+                while not self._replies.empty():
+                    self._replies.get_nowait()
 
     def wait_and_handle_boot(self):
         self.handle_boot(self.wait_boot())
@@ -365,8 +660,12 @@ class UartInterface(Reloadable):
             print(f"Enabled features: {features}")
 
         self.enabled_features = features
+        self.last_exc = (0, 0, 0) if features & Feature.EXC_INFO else None
 
     def proxyreq(self, req, reboot=False, no_reply=False, pre_reply=None):
+        if not (no_reply or reboot):
+            self._expect_reply(self.REQ_PROXY,
+                               self.EXC_INFO_LEN if self.enabled_features & Feature.EXC_INFO else 0)
         self.cmd(self.REQ_PROXY, req)
         if pre_reply:
             pre_reply()
@@ -374,8 +673,15 @@ class UartInterface(Reloadable):
             return
         elif reboot:
             return self.wait_boot()
-        else:
-            return self.reply(self.REQ_PROXY)
+
+        reply = self.reply(self.REQ_PROXY)
+        if self.enabled_features & Feature.EXC_INFO:
+            info = self.readfull(self.EXC_INFO_LEN)
+            esr, far, count, checksum = struct.unpack("<QQII", info)
+            if checksum != self.checksum(info[:-4]):
+                raise UartChecksumError()
+            self.last_exc = (count, esr, far)
+        return reply
 
     def writemem(self, addr, data, progress=False):
         checksum = self.data_checksum(data)
@@ -385,8 +691,9 @@ class UartInterface(Reloadable):
         if self.debug:
             print("<< DATA:")
             chexdump(data)
-        for i in range(0, len(data), 8192):
-            self.dev.write(data[i:i + 8192])
+        chunk = getattr(self.dev, "write_chunk", 8192)
+        for i in range(0, len(data), chunk):
+            self.dev.write(data[i:i + chunk])
             if progress:
                 sys.stdout.write(".")
                 sys.stdout.flush()
@@ -404,6 +711,8 @@ class UartInterface(Reloadable):
             return b""
 
         req = struct.pack("<QQ", addr, size)
+        self._expect_reply(self.REQ_MEMREAD,
+                           size + (4 if self.enabled_features & Feature.DISABLE_DATA_CSUMS else 0))
         self.cmd(self.REQ_MEMREAD, req)
         reply = self.reply(self.REQ_MEMREAD)
         checksum = struct.unpack("<I",reply[:4])[0]
@@ -439,6 +748,9 @@ class ProxyRemoteError(ProxyError):
 class ProxyCommandError(ProxyRemoteError):
     pass
 
+class ProxyExceptionError(ProxyRemoteError):
+    pass
+
 class AlignmentError(Exception):
     pass
 
@@ -475,6 +787,13 @@ REGION_RX_EL1 = 0xc0000000000
 class M1N1Proxy(Reloadable):
     S_OK = 0
     S_BADCMD = -1
+    S_EXC = -2
+
+    # Device-side executable stub slots (see P_CODE_SLOT_CALL)
+    CODE_SLOT_COUNT = 64
+    CODE_SLOT_SIZE = 256
+    CODE_SLOT_SYNC = 1 << 16
+    CODE_SLOT_MODES = {None: 0, "el2": 0, "el1": 1, "el0": 2, "gl2": 3, "gl1": 4}
 
     P_NOP = 0x000
     P_EXIT = 0x001
@@ -494,6 +813,11 @@ class M1N1Proxy(Reloadable):
     P_PUT_SIMD_STATE = 0x00f
     P_REBOOT = 0x010
     P_SLEEP = 0x011
+    P_MRS = 0x012
+    P_MSR = 0x013
+    P_MRS_BATCH = 0x014
+    P_CODE_SLOT_INFO = 0x015
+    P_CODE_SLOT_CALL = 0x016
 
     P_WRITE64 = 0x100
     P_WRITE32 = 0x101
@@ -528,6 +852,8 @@ class M1N1Proxy(Reloadable):
     P_MEMSET32 = 0x205
     P_MEMSET16 = 0x206
     P_MEMSET8 = 0x207
+    P_MEMZERO = 0x208
+    P_MEMDIFF32 = 0x209
 
     P_IC_IALLUIS = 0x300
     P_IC_IALLU = 0x301
@@ -548,6 +874,7 @@ class M1N1Proxy(Reloadable):
 
     P_XZDEC = 0x400
     P_GZDEC = 0x401
+    P_LZ4DEC = 0x402
 
     P_SMP_START_SECONDARIES = 0x500
     P_SMP_CALL = 0x501
@@ -558,11 +885,12 @@ class M1N1Proxy(Reloadable):
     P_SMP_STOP_SECONDARIES = 0x506
     P_SMP_CALL_EL1 = 0x507
     P_SMP_CALL_SYNC_EL1 = 0x508
+    P_SMP_PARALLEL_FOR = 0x509
 
     P_HEAPBLOCK_ALLOC = 0x600
     P_MALLOC = 0x601
     P_MEMALIGN = 0x602
-    P_FREE = 0x602
+    P_FREE = 0x603
 
     P_KBOOT_BOOT = 0x700
     P_KBOOT_SET_CHOSEN = 0x701
@@ -585,6 +913,12 @@ class M1N1Proxy(Reloadable):
 
     P_TUNABLES_APPLY_GLOBAL = 0xa00
     P_TUNABLES_APPLY_LOCAL = 0xa01
+    P_TUNABLES_APPLY_LOCAL_ADDR = 0xa02
+    P_TUNABLES_COMPILE_GLOBAL = 0xa03
+    P_TUNABLES_COMPILE_LOCAL = 0xa04
+    P_TUNABLES_COMPILE_LOCAL_ADDR = 0xa05
+    P_TUNABLES_APPLY_PROG = 0xa06
+    P_TUNABLES_GET_MMIO_SAVED = 0xa07
 
     P_DART_INIT = 0xb00
     P_DART_SHUTDOWN = 0xb01
@@ -644,6 +978,7 @@ class M1N1Proxy(Reloadable):
         self.debug = debug
         self.iface = iface
         self.heap = None
+        self.exc_pending = (0, None, None)
 
     def _request(self, opcode, *args, reboot=False, signed=False, no_reply=False, pre_reply=None):
         if len(args) > 6:
@@ -659,6 +994,13 @@ class M1N1Proxy(Reloadable):
         rop, status, retval = struct.unpack("<Qq" + ret_fmt, reply)
         if self.debug:
             print(">>>> %08x: %d %08x"%(rop, status, retval))
+        exc = getattr(self.iface, "last_exc", None)
+        if exc is not None:
+            # Mirror the device-side counter, which these two requests reset
+            if opcode in (self.P_SET_EXC_GUARD, self.P_GET_EXC_COUNT):
+                self.exc_pending = (0, None, None)
+            elif exc[0] and status != self.S_EXC: # S_EXC raises below already
+                self.exc_pending = (self.exc_pending[0] + exc[0], exc[1], exc[2])
         if reboot:
             return
         if rop != opcode:
@@ -666,6 +1008,8 @@ class M1N1Proxy(Reloadable):
         if status != self.S_OK:
             if status == self.S_BADCMD:
                 raise ProxyCommandError("Reply error: Bad Command")
+            elif status == self.S_EXC:
+                raise ProxyExceptionError("Reply error: Exception occurred")
             else:
                 raise ProxyRemoteError("Reply error: Unknown error (%d)"%status)
         return retval
@@ -734,6 +1078,31 @@ class M1N1Proxy(Reloadable):
         self.request(self.P_SET_EXC_GUARD, mode)
     def get_exc_count(self):
         return self.request(self.P_GET_EXC_COUNT)
+    def take_exc(self):
+        '''(count, ESR, FAR) of guarded exceptions since the last check, like get_exc_count()'''
+        if getattr(self.iface, "last_exc", None) is None:
+            return (self.get_exc_count(), None, None)
+        exc, self.exc_pending = self.exc_pending, (0, None, None)
+        return exc
+    def check_exc(self):
+        count, esr, far = self.take_exc()
+        if count:
+            if esr is None:
+                raise ProxyExceptionError("Exception occurred")
+            raise ProxyExceptionError(f"Exception occurred (x{count}): ESR=0x{esr:x} FAR=0x{far:x}")
+    def mrs(self, enc, silent=False):
+        return self.request(self.P_MRS, enc, 0, GUARD.SILENT if silent else 0)
+    def msr(self, enc, val, silent=False):
+        self.request(self.P_MSR, enc, val, GUARD.SILENT if silent else 0)
+    def mrs_batch(self, encs, out, count, silent=False):
+        return self.request(self.P_MRS_BATCH, encs, out, count, GUARD.SILENT if silent else 0)
+    def code_slot_info(self):
+        return self.request(self.P_CODE_SLOT_INFO)
+    def code_slot_call(self, slot, *args, mode=0, sync=False, silent=False):
+        if len(args) > 4:
+            raise ValueError("Too many arguments")
+        flags = (GUARD.SILENT if silent else 0) | (self.CODE_SLOT_SYNC if sync else 0) | (mode << 20)
+        return self.request(self.P_CODE_SLOT_CALL, slot, flags, *args)
     def el0_call(self, addr, *args):
         if len(args) > 4:
             raise ValueError("Too many arguments")
@@ -901,6 +1270,10 @@ class M1N1Proxy(Reloadable):
         self.request(self.P_MEMSET16, dst, src, size)
     def memset8(self, dst, src, size):
         self.request(self.P_MEMSET8, dst, src, size)
+    def memzero(self, dst, size):
+        self.request(self.P_MEMZERO, dst, size)
+    def memdiff32(self, src, snapshot, size, out, out_size):
+        return self.request(self.P_MEMDIFF32, src, snapshot, size, out, out_size, signed=True)
 
     def ic_ialluis(self):
         self.request(self.P_IC_IALLUIS)
@@ -944,6 +1317,10 @@ class M1N1Proxy(Reloadable):
         return self.request(self.P_GZDEC, inbuf, insize, outbuf,
                             outsize, signed=True)
 
+    def lz4dec(self, inbuf, insize, outbuf, outsize):
+        return self.request(self.P_LZ4DEC, inbuf, insize, outbuf,
+                            outsize, signed=True)
+
     def smp_start_secondaries(self):
         self.request(self.P_SMP_START_SECONDARIES)
     def smp_call(self, cpu, addr, *args):
@@ -970,6 +1347,8 @@ class M1N1Proxy(Reloadable):
         if len(args) > 3:
             raise ValueError("Too many arguments")
         return self.request(self.P_SMP_CALL_SYNC_EL1, cpu, addr, *args)
+    def smp_parallel_for(self, addr, start, end, grain=0, arg=0):
+        return self.request(self.P_SMP_PARALLEL_FOR, addr, start, end, grain, arg)
 
     def heapblock_alloc(self, size):
         return self.request(self.P_HEAPBLOCK_ALLOC, size)
@@ -1020,7 +1399,17 @@ class M1N1Proxy(Reloadable):
     def tunables_apply_local(self, path, prop, reg_offset):
         return self.request(self.P_TUNABLES_APPLY_LOCAL, path, prop, reg_offset)
     def tunables_apply_local_addr(self, path, prop, base):
-        return self.request(self.P_TUNABLES_APPLY_LOCAL, path, prop, base)
+        return self.request(self.P_TUNABLES_APPLY_LOCAL_ADDR, path, prop, base)
+    def tunables_compile_global(self, path, prop):
+        return self.request(self.P_TUNABLES_COMPILE_GLOBAL, path, prop)
+    def tunables_compile_local(self, path, prop, reg_offset):
+        return self.request(self.P_TUNABLES_COMPILE_LOCAL, path, prop, reg_offset)
+    def tunables_compile_local_addr(self, path, prop, base):
+        return self.request(self.P_TUNABLES_COMPILE_LOCAL_ADDR, path, prop, base)
+    def tunables_apply_prog(self, prog):
+        return self.request(self.P_TUNABLES_APPLY_PROG, prog)
+    def tunables_get_mmio_saved(self):
+        return self.request(self.P_TUNABLES_GET_MMIO_SAVED)
 
     def dart_init(self, base, sid, dart_type=DART.T8020):
         return self.request(self.P_DART_INIT, base, sid, dart_type)
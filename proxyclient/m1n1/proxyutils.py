@@ -1,5 +1,5 @@
 # SPDX-License-Identifier: MIT
-import serial, os, struct, sys, time, json, os.path, gzip, functools
+import serial, os, struct, sys, time, json, os.path, gzip, functools, hashlib, collections
 from contextlib import contextmanager
 from construct import *
 
@@ -39,6 +39,12 @@ VERSION_MAP = {
 
 class ProxyUtils(Reloadable):
     CODE_BUFFER_SIZE = 0x10000
+    # Set M1N1ADTCACHE= (empty) to always fetch the ADT from the device
+    ADT_CACHE_DIR = os.environ.get("M1N1ADTCACHE",
+        os.path.join(os.environ.get("XDG_CACHE_HOME", os.path.expanduser("~/.cache")), "m1n1", "adt"))
+    ADT_PROBE_SIZE = 0x10000
+    ADT_DIFF_BLOCK = 0x100
+
     def __init__(self, p, heap_size=1024 * 1024 * 1024):
         self.iface = p.iface
         self.proxy = p
@@ -76,6 +82,7 @@ class ProxyUtils(Reloadable):
         self.code_buffer = self.malloc(self.CODE_BUFFER_SIZE)
 
         self.adt_data = None
+        self.adt_cache_path = None
         self.adt = LazyADT(self)
 
         self.simd_buf = self.malloc(32 * 16)
@@ -86,6 +93,20 @@ class ProxyUtils(Reloadable):
 
         self.inst_cache = {}
 
+        # Cleared on the first P_MRS/P_MSR rejected by an older m1n1, which then goes through exec()
+        self.native_sysreg = True
+
+        # exec() stubs resident in device code slots, least recently used first
+        self.code_slots = collections.OrderedDict()
+        # Source ops assembled for a given slot address, so they can return to it without the
+        # assembler
+        self.slot_code = {}
+        try:
+            self.code_slot_base = p.code_slot_info()
+        except ProxyCommandError:
+            # Older m1n1 without code slots, exec() uploads to code_buffer every time
+            self.code_slot_base = None
+
         self.exec_modes = {
             None: (self.proxy.call, REGION_RX_EL1),
             "el2": (self.proxy.call, REGION_RX_EL1),
@@ -145,39 +166,96 @@ class ProxyUtils(Reloadable):
         '''do a width read from addr and return it
         width can be 8, 16, 21, 64, 128 or 256'''
         val = self._read[width](addr)
-        if self.proxy.get_exc_count():
-            raise ProxyError("Exception occurred")
+        self.proxy.check_exc()
         return val
 
     def write(self, addr, data, width):
         '''do a width write of data to addr
         width can be 8, 16, 21, 64, 128 or 256'''
         self._write[width](addr, data)
-        if self.proxy.get_exc_count():
-            raise ProxyError("Exception occurred")
+        self.proxy.check_exc()
+
+    @staticmethod
+    def _sysreg_enc(reg):
+        op0, op1, CRn, CRm, op2 = sysreg_parse(reg)
+        return (op0 << 19) | (op1 << 16) | (CRn << 12) | (CRm << 8) | (op2 << 5)
 
     def mrs(self, reg, *, silent=False, call=None):
         '''read system register reg'''
-        op0, op1, CRn, CRm, op2 = sysreg_parse(reg)
+        enc = self._sysreg_enc(reg)
 
-        op =  ((op0 << 19) | (op1 << 16) | (CRn << 12) |
-               (CRm << 8) | (op2 << 5) | 0xd5200000)
+        if call in (None, "el2") and self.native_sysreg:
+            try:
+                return self.proxy.mrs(enc, silent)
+            except ProxyExceptionError:
+                raise ProxyError("Exception occurred")
+            except ProxyCommandError:
+                self.native_sysreg = False
 
-        return self.exec(op, call=call, silent=silent)
+        return self.exec(enc | 0xd5200000, call=call, silent=silent)
 
     def msr(self, reg, val, *, silent=False, call=None):
         '''Write val to system register reg'''
-        op0, op1, CRn, CRm, op2 = sysreg_parse(reg)
+        enc = self._sysreg_enc(reg)
 
-        op =  ((op0 << 19) | (op1 << 16) | (CRn << 12) |
-               (CRm << 8) | (op2 << 5) | 0xd5000000)
+        if call in (None, "el2") and self.native_sysreg:
+            try:
+                return self.proxy.msr(enc, val, silent)
+            except ProxyExceptionError:
+                raise ProxyError("Exception occurred")
+            except ProxyCommandError:
+                self.native_sysreg = False
+
+        self.exec(enc | 0xd5000000, val, call=call, silent=silent)
+
+    def mrs_batch(self, regs, *, silent=True):
+        '''read a list of system registers in one request; faulting ones read as None'''
+        encs = [self._sysreg_enc(reg) for reg in regs]
+        if not encs:
+            return []
+
+        if self.native_sysreg:
+            with self.heap.guarded_malloc(len(encs) * 8) as enc_buf, \
+                 self.heap.guarded_malloc(len(encs) * 16) as out_buf:
+                self.iface.writemem(enc_buf, struct.pack(f"<{len(encs)}Q", *encs))
+                try:
+                    self.proxy.mrs_batch(enc_buf, out_buf, len(encs), silent)
+                except ProxyCommandError:
+                    self.native_sysreg = False
+                else:
+                    out = struct.unpack(f"<{2 * len(encs)}Q",
+                                        self.iface.readmem(out_buf, len(encs) * 16))
+                    return [None if fault else val for val, fault in zip(out[::2], out[1::2])]
 
-        self.exec(op, val, call=call, silent=silent)
+        vals = []
+        for enc in encs:
+            try:
+                vals.append(self.exec(enc | 0xd5200000, silent=silent))
+            except ProxyExceptionError:
+                vals.append(None)
+        return vals
 
     sys = msr
     sysl = mrs
 
     def exec(self, op, r0=0, r1=0, r2=0, r3=0, *, silent=False, call=None, ignore_exceptions=False):
+        if isinstance(op, list):
+            op = tuple(op)
+
+        if (self.code_slot_base is not None and not ignore_exceptions and
+            call in self.proxy.CODE_SLOT_MODES):
+            slot, fresh = self._code_slot(op)
+            if slot is not None:
+                try:
+                    return self.proxy.code_slot_call(slot, r0, r1, r2, r3, silent=silent, sync=fresh,
+                                                     mode=self.proxy.CODE_SLOT_MODES[call])
+                except ProxyExceptionError:
+                    raise
+                except:
+                    # The slot may not have been synced, so upload it again next time
+                    self.code_slots.pop(op, None)
+                    raise
+
         if callable(call):
             region = REGION_RX_EL1
         elif isinstance(call, tuple):
@@ -185,22 +263,10 @@ class ProxyUtils(Reloadable):
         else:
             call, region = self.exec_modes[call]
 
-        if isinstance(op, list):
-            op = tuple(op)
-
         if op in self.inst_cache:
             func = self.inst_cache[op]
-        elif isinstance(op, tuple) or isinstance(op, list):
-            func = struct.pack(f"<{len(op)}II", *op, 0xd65f03c0) # ret
-        elif isinstance(op, int):
-            func = struct.pack("<II", op, 0xd65f03c0) # ret
-        elif isinstance(op, str):
-            c = ARMAsm(op + "; ret", self.code_buffer)
-            func = c.data
-        elif isinstance(op, bytes):
-            func = op
         else:
-            raise ValueError()
+            func = self._exec_code(op, self.code_buffer)
 
         if self.mmu_off:
             region = 0
@@ -215,10 +281,10 @@ class ProxyUtils(Reloadable):
         self.proxy.set_exc_guard(GUARD.SKIP | (GUARD.SILENT if silent else 0))
         ret = call(self.code_buffer | region, r0, r1, r2, r3)
         if not ignore_exceptions:
-            cnt = self.proxy.get_exc_count()
+            exc = self.proxy.take_exc()
             self.proxy.set_exc_guard(GUARD.OFF)
-            if cnt:
-                raise ProxyError("Exception occurred")
+            if exc[0]:
+                raise ProxyExceptionError("Exception occurred")
         else:
             self.proxy.set_exc_guard(GUARD.OFF)
 
@@ -226,6 +292,87 @@ class ProxyUtils(Reloadable):
 
     inst = exec
 
+    def _exec_code(self, op, addr):
+        if isinstance(op, tuple):
+            return struct.pack(f"<{len(op)}II", *op, 0xd65f03c0) # ret
+        elif isinstance(op, int):
+            return struct.pack("<II", op, 0xd65f03c0) # ret
+        elif isinstance(op, str):
+            return ARMAsm(op + "; ret", addr).data
+        elif isinstance(op, bytes):
+            return op
+        else:
+            raise ValueError()
+
+    def _next_slot(self, slots):
+        '''Slot that the LRU order in slots hands to the next new op'''
+        if len(slots) < self.proxy.CODE_SLOT_COUNT:
+            return len(slots)
+        return next(iter(slots.values()))
+
+    def _slot_addr(self, slot):
+        return self.code_slot_base + slot * self.proxy.CODE_SLOT_SIZE
+
+    def _slot_code(self, op, addr):
+        # Only source ops depend on where they run, the rest share the code_buffer cache
+        if not isinstance(op, str):
+            if op not in self.inst_cache:
+                self.inst_cache[op] = self._exec_code(op, addr)
+            return self.inst_cache[op]
+
+        if (op, addr) not in self.slot_code:
+            self.slot_code[(op, addr)] = self._exec_code(op, addr)
+        return self.slot_code[(op, addr)]
+
+    def _code_slot(self, op):
+        '''Return (slot, fresh) for the device code slot holding op, uploading it to the least
+        recently used slot if needed. fresh means the slot still needs cache maintenance.'''
+        if op in self.code_slots:
+            self.code_slots.move_to_end(op)
+            return self.code_slots[op], False
+
+        slot = self._next_slot(self.code_slots)
+
+        # Assemble at the slot itself, so that source ops need not be position independent
+        addr = self._slot_addr(slot)
+        func = self._slot_code(op, addr)
+        if len(func) > self.proxy.CODE_SLOT_SIZE:
+            return None, False
+
+        if len(self.code_slots) == self.proxy.CODE_SLOT_COUNT:
+            self.code_slots.popitem(last=False)
+        self.iface.writemem(addr, func)
+        self.code_slots[op] = slot
+        return slot, True
+
+    def precompile(self, ops):
+        '''assemble many exec() source snippets in one toolchain run, ahead of executing them in
+        the given order'''
+        ops = [op for op in ops if isinstance(op, str)]
+
+        if self.code_slot_base is None:
+            todo = [(op, self.code_buffer) for op in dict.fromkeys(ops) if op not in self.inst_cache]
+        else:
+            # Replay the slot LRU to find the address each op will be assembled for
+            slots = collections.OrderedDict(self.code_slots)
+            todo = []
+            for op in ops:
+                if op in slots:
+                    slots.move_to_end(op)
+                    continue
+                slot = self._next_slot(slots)
+                if len(slots) == self.proxy.CODE_SLOT_COUNT:
+                    slots.popitem(last=False)
+                slots[op] = slot
+                todo.append((op, self._slot_addr(slot)))
+            todo = [key for key in dict.fromkeys(todo) if key not in self.slot_code]
+
+        for (op, addr), c in zip(todo, ARMAsm.batch((op + "; ret", addr) for op, addr in todo)):
+            if self.code_slot_base is None:
+                self.inst_cache[op] = c.data
+            else:
+                self.slot_code[(op, addr)] = c.data
+
     def compressed_writemem(self, dest, data, progress=None):
         if not len(data):
             return
@@ -244,21 +391,87 @@ class ProxyUtils(Reloadable):
 
             assert decompressed_size == len(data)
 
+    @property
+    def _adt_base(self):
+        return (self.ba.devtree - self.ba.virt_base + self.ba.phys_base) & 0xffffffffffffffff
+
+    def _adt_cache_path(self, head):
+        # The root node carries the serial number and /chosen (its first child) a random-seed that
+        # iBoot regenerates on every boot, so together they identify this boot's ADT.
+        try:
+            root, child_count, off = adt.parse_raw_node(head)
+            chosen, _, _ = adt.parse_raw_node(head, off) if child_count else ({}, 0, 0)
+        except (ValueError, struct.error):
+            return None
+
+        if "serial-number" not in root or chosen.get("name", (b"",))[0].rstrip(b"\0") != b"chosen":
+            return None
+        serial = root["serial-number"][0].rstrip(b"\0").decode("ascii", "replace")
+        nonce = chosen.get("random-seed", (b"",))[0]
+
+        h = hashlib.sha256(nonce)
+        h.update(struct.pack("<QQ", self.ba.devtree, self.ba.devtree_size))
+        return os.path.join(self.ADT_CACHE_DIR, f"{serial}-{h.hexdigest()[:16]}.adt")
+
+    def _adt_cache_store(self):
+        if not self.adt_cache_path:
+            return
+        try:
+            os.makedirs(os.path.dirname(self.adt_cache_path), exist_ok=True)
+            with open(self.adt_cache_path + ".tmp", "wb") as fd:
+                fd.write(self.adt_data)
+            os.replace(self.adt_cache_path + ".tmp", self.adt_cache_path)
+        except OSError as e:
+            print(f"Could not write ADT cache {self.adt_cache_path}: {e}")
+
     def get_adt(self):
         if self.adt_data is not None:
             return self.adt_data
-        adt_base = (self.ba.devtree - self.ba.virt_base + self.ba.phys_base) & 0xffffffffffffffff
         adt_size = self.ba.devtree_size
+
+        head = self.iface.readmem(self._adt_base, min(adt_size, self.ADT_PROBE_SIZE))
+        self.adt_cache_path = self._adt_cache_path(head) if self.ADT_CACHE_DIR else None
+        if self.adt_cache_path and os.path.exists(self.adt_cache_path):
+            with open(self.adt_cache_path, "rb") as fd:
+                data = fd.read()
+            if len(data) == adt_size and data.startswith(head):
+                print(f"Using cached ADT from {self.adt_cache_path}")
+                self.adt_data = data
+                return self.adt_data
+
         print(f"Fetching ADT ({adt_size} bytes)...")
-        self.adt_data = self.iface.readmem(adt_base, self.ba.devtree_size)
+        self.adt_data = head + self.iface.readmem(self._adt_base + len(head), adt_size - len(head))
+        self._adt_cache_store()
         return self.adt_data
 
     def push_adt(self):
-        self.adt_data = self.adt.build()
-        adt_base = (self.ba.devtree - self.ba.virt_base + self.ba.phys_base) & 0xffffffffffffffff
-        adt_size = len(self.adt_data)
-        print(f"Pushing ADT ({adt_size} bytes)...")
-        self.iface.writemem(adt_base, self.adt_data)
+        data = self.adt.build()
+        old = self.adt_data
+
+        if old is None or len(data) > len(old):
+            print(f"Pushing ADT ({len(data)} bytes)...")
+            self.iface.writemem(self._adt_base, data)
+        else:
+            # Unchanged nodes are rebuilt byte-identical, so only write back what differs and clear
+            # whatever the previous ADT had past the new end
+            data += bytes(len(old) - len(data))
+            blk = self.ADT_DIFF_BLOCK
+            ranges = []
+            for off in range(0, len(data), blk):
+                if data[off:off + blk] == old[off:off + blk]:
+                    continue
+                if ranges and ranges[-1][1] == off:
+                    ranges[-1][1] = min(off + blk, len(data))
+                else:
+                    ranges.append([off, min(off + blk, len(data))])
+
+            size = sum(end - start for start, end in ranges)
+            print(f"Pushing ADT ({size} of {len(data)} bytes changed)...")
+            for start, end in ranges:
+                self.iface.writemem(self._adt_base + start, data[start:end])
+
+        self.adt_data = data
+        self._adt_cache_store()
 
     def disassemble_at(self, start, size, pc=None, vstart=None, sym=None):
         '''disassemble len bytes of memory from start
@@ -444,6 +657,7 @@ class RegMonitor(Reloadable):
         self.iface = self.proxy.iface
         self.ranges = []
         self.last = []
+        self.snapshots = []
         self.bufsize = bufsize
         self.ascii = ascii
         self.log = log or print
@@ -462,11 +676,37 @@ class RegMonitor(Reloadable):
             start = self.scratch
         return self.proxy.iface.readmem(start, size)
 
+    def diffmem(self, idx, start, size, last):
+        '''Diff against a snapshot kept on the device, transferring only the changed words'''
+        snap = self.snapshots[idx]
+        if snap is None:
+            snap = self.snapshots[idx] = self.utils.malloc(size)
+            last = None
+
+        if last is None:
+            self.proxy.memcpy32(snap, start, size)
+            return self.proxy.iface.readmem(snap, size)
+
+        changed = self.proxy.memdiff32(start, snap, size, self.scratch, self.bufsize)
+        if changed < 0:
+            return None
+        if changed == 0:
+            return last
+        if changed * 8 > self.bufsize:
+            return self.proxy.iface.readmem(snap, size)
+
+        block = bytearray(last)
+        pairs = self.proxy.iface.readmem(self.scratch, changed * 8)
+        for off, val in struct.iter_unpack("<II", pairs):
+            block[off:off + 4] = struct.pack("<I", val)
+        return bytes(block)
+
     def add(self, start, size, name=None, offset=None, readfn=None):
         if offset is None:
             offset = start
         self.ranges.append((start, size, name, offset, readfn))
         self.last.append(None)
+        self.snapshots.append(None)
 
     def show_regions(self, log=print):
         for start, size, name, offset, readfn in sorted(self.ranges):
@@ -477,9 +717,12 @@ class RegMonitor(Reloadable):
         if not self.ranges:
             return
         cur = []
-        for (start, size, name, offset, readfn), last in zip(self.ranges, self.last):
+        for idx, ((start, size, name, offset, readfn), last) in enumerate(zip(self.ranges, self.last)):
             count = size // 4
-            block = self.readmem(start, size, readfn)
+            if readfn is None and self.scratch:
+                block = self.diffmem(idx, start, size, last)
+            else:
+                block = self.readmem(start, size, readfn)
             if block is None:
                 if last is not None:
                     self.log(f"# Lost: {name} ({start:#x}..{start + size - 1:#x})")
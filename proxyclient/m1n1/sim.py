@@ -0,0 +1,94 @@
+# SPDX-License-Identifier: MIT
+"""Host-side simulator of the m1n1 proxy, for benchmarking and testing the host stack.
+
+This builds tools/proxysim (src/uartproxy.c plus host shims) and runs it on a pty. Point the
+proxyclient at the pty with M1N1DEVICE=<path>, or pass ProxySim.device to UartInterface.
+"""
+import os, pathlib, shutil, subprocess, sys, tempfile, threading
+
+__all__ = ["ProxySim"]
+
+ROOT = pathlib.Path(__file__).resolve().parents[2]
+
+class ProxySim:
+    SIM_FILES = ["sim.c", "utils.h", "memory.h", "string.h", "fb.h"]
+    SRC_FILES = ["uartproxy.c", "uartproxy.h", "iodev.h", "exception.h", "proxy.h", "types.h",
+                 "xnuboot.h"]
+
+    def __init__(self, event_rate=0, event_type="mmio", mem_mib=8192, serial=None,
+                 cc=None, quiet=True):
+        self.event_rate = event_rate
+        self.event_type = event_type
+        self.mem_mib = mem_mib
+        self.serial = serial
+        self.cc = cc or os.environ.get("CC", "cc")
+        self.quiet = quiet
+        self.proc = None
+        self.device = None
+        self._workdir = None
+
+    def build(self):
+        self._workdir = pathlib.Path(tempfile.mkdtemp(prefix="proxysim-"))
+        for f in self.SIM_FILES:
+            shutil.copy(ROOT / "tools" / "proxysim" / f, self._workdir / f)
+        for f in self.SRC_FILES:
+            shutil.copy(ROOT / "src" / f, self._workdir / f)
+
+        binary = self._workdir / "proxysim"
+        subprocess.check_call([self.cc, "-O2", "-Wall", "-Wno-multichar", "-iquote",
+                               str(self._workdir), "-o", str(binary),
+                               str(self._workdir / "sim.c"), str(self._workdir / "uartproxy.c")])
+        return binary
+
+    def start(self):
+        cmd = [str(self.build()), "-m", str(self.mem_mib), "-r", str(self.event_rate),
+               "-t", self.event_type]
+        if self.serial:
+            cmd += ["-s", self.serial]
+
+        self.proc = subprocess.Popen(cmd, stdout=subprocess.PIPE, text=True)
+        self.device = self.proc.stdout.readline().strip()
+        if not self.device:
+            raise RuntimeError("proxysim failed to start")
+
+        # Keep draining the simulated console so the simulator never blocks on it
+        threading.Thread(target=self._console, daemon=True).start()
+        return self.device
+
+    def _console(self):
+        for line in self.proc.stdout:
+            if not self.quiet:
+                sys.stderr.write(f"SIM> {line}")
+
+    def stop(self):
+        if self.proc:
+            self.proc.terminate()
+            self.proc.wait()
+            self.proc = None
+        if self._workdir:
+            shutil.rmtree(self._workdir, ignore_errors=True)
+            self._workdir = None
+
+    def __enter__(self):
+        self.start()
+        return self
+
+    def __exit__(self, *exc):
+        self.stop()
+
+if __name__ == "__main__":
+    import argparse
+
+    parser = argparse.ArgumentParser(description="Run the m1n1 proxy simulator on a pty")
+    parser.add_argument("-r", "--event-rate", type=int, default=0, help="trace events/sec")
+    parser.add_argument("-t", "--event-type", choices=("mmio", "irq"), default="mmio")
+    parser.add_argument("-m", "--mem", type=int, default=8192, help="simulated RAM in MiB")
+    parser.add_argument("-s", "--serial", help="serial number reported in the ADT")
+    args = parser.parse_args()
+
+    with ProxySim(args.event_rate, args.event_type, args.mem, args.serial, quiet=False) as sim:
+        print(f"export M1N1DEVICE={sim.device}")
+        try:
+            sim.proc.wait()
+        except KeyboardInterrupt:
+            pass
@@ -2,6 +2,7 @@
 from enum import Enum
 import threading, traceback, bisect, copy, heapq, importlib, sys, itertools, time, os, functools, struct, re, signal
 from construct import Adapter, Int64ul, Int32ul, Int16ul, Int8ul, ExprAdapter, GreedyRange, ListContainer, StopFieldError, ExplicitError, StreamError
+from construct import Array, Container, Hex, HexDisplayedInteger, Renamed, Struct, Subconstruct
 
 __all__ = ["FourCC"]
 
@@ -460,6 +461,80 @@ class RegAdapter(Adapter):
     def _encode(self, obj, context, path):
         return obj.value
 
+class FastStruct(Subconstruct):
+    """Drop-in wrapper for a flat Struct that is decoded on every event or exception.
+
+    Only little-endian integers, Hex(), RegAdapter() and fixed-size Arrays of those are allowed.
+    parse() and build() then go through a precompiled struct.Struct, which is well over an order of
+    magnitude faster than construct. The result is the same Container construct would produce;
+    embedded in other constructs, it behaves like the Struct itself.
+    """
+    _FORMATS = {Int8ul: "B", Int16ul: "H", Int32ul: "I", Int64ul: "Q"}
+
+    def __init__(self, subcon):
+        super().__init__(subcon)
+        if not isinstance(subcon, Struct):
+            raise TypeError("FastStruct needs a Struct")
+
+        fmt = "<"
+        self._fields = []
+        idx = 0
+        for sc in subcon.subcons:
+            if not isinstance(sc, Renamed):
+                raise TypeError(f"Unsupported anonymous field {sc!r}")
+            name, sc = sc.name, sc.subcon
+            count = None
+            if isinstance(sc, Array):
+                if not isinstance(sc.count, int):
+                    raise TypeError(f"{name}: only fixed-size arrays are supported")
+                count, sc = sc.count, sc.subcon
+            conv = None
+            if isinstance(sc, RegAdapter):
+                conv, sc = functools.partial(self._reg, sc.reg), sc.subcon
+            elif isinstance(sc, Hex):
+                sc = sc.subcon
+                conv = functools.partial(HexDisplayedInteger.new, fmtstr=f"0{2 * sc.sizeof()}X")
+            if sc not in self._FORMATS:
+                raise TypeError(f"{name}: unsupported field type {sc!r}")
+
+            fmt += f"{count or ''}{self._FORMATS[sc]}"
+            self._fields.append((name, idx, count, conv))
+            idx += count or 1
+
+        self._struct = struct.Struct(fmt)
+
+    @staticmethod
+    def _reg(cls, v):
+        # Skip the per-field validation in Register.__init__, the value came from a full-width int
+        r = cls.__new__(cls)
+        r._value = v
+        return r
+
+    def parse(self, data, **contextkw):
+        vals = self._struct.unpack_from(data)
+        obj = Container()
+        for name, idx, count, conv in self._fields:
+            if count is None:
+                obj[name] = conv(vals[idx]) if conv else vals[idx]
+            elif conv:
+                obj[name] = ListContainer(map(conv, vals[idx:idx + count]))
+            else:
+                obj[name] = ListContainer(vals[idx:idx + count])
+        return obj
+
+    def build(self, obj, **contextkw):
+        vals = []
+        for name, idx, count, conv in self._fields:
+            v = obj[name]
+            if count is None:
+                vals.append(v.value if isinstance(v, Register) else v)
+            else:
+                vals.extend(i.value if isinstance(i, Register) else i for i in v)
+        return self._struct.pack(*vals)
+
+    def sizeof(self, **contextkw):
+        return self._struct.size
+
 class RangeMap(Reloadable):
     def __init__(self):
         self.__start = []
@@ -684,6 +759,38 @@ class AddrLookup(RangeMap):
     def _assert(self, expect, val=lambda a:a):
         super()._assert(expect, lambda v: [i[0] for i in v])
 
+class SymbolIndex:
+    """Immutable address -> symbol index, built once per symbol load.
+
+    Addresses and names are kept in parallel sorted lists so lookups bisect over plain ints,
+    and the most recently resolved addresses are memoized, since traces and backtraces keep
+    hitting the same few PCs.
+    """
+    def __init__(self, symbols=(), cache_size=8192):
+        syms = sorted(symbols)
+        self.addrs = [a for a, n in syms]
+        self.names = [n for a, n in syms]
+        self.lookup = functools.lru_cache(cache_size)(self._lookup)
+
+    def _lookup(self, addr):
+        idx = bisect.bisect_right(self.addrs, addr) - 1
+        if idx < 0:
+            return None, None
+        return self.addrs[idx], self.names[idx]
+
+    def exact(self, addr):
+        saddr, name = self.lookup(addr)
+        return name if saddr == addr else None
+
+    def __len__(self):
+        return len(self.addrs)
+
+    def __getitem__(self, idx):
+        return self.addrs[idx], self.names[idx]
+
+    def __iter__(self):
+        return zip(self.addrs, self.names)
+
 class ScalarRangeMap(RangeMap):
     def get(self, addr, default=None):
         return self.lookup(addr, default)
@@ -0,0 +1,33 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+import sys, pathlib
+sys.path.append(str(pathlib.Path(__file__).resolve().parents[1]))
+
+import argparse, tempfile, time
+
+from m1n1.asm import ARMAsm
+
+parser = argparse.ArgumentParser(description='Snippet assembly rate: one by one, batched and cached')
+parser.add_argument('-n', '--snippets', type=int, default=100, help='distinct snippets to assemble')
+args = parser.parse_args()
+
+snippets = [(f"mov x0, #{i}\nmrs x1, SPSel\nadd x0, x0, x1\nret", 0x800000000 + i * 0x100)
+            for i in range(args.snippets)]
+
+def timed(label, fn):
+    t = time.perf_counter()
+    objs = fn()
+    t = time.perf_counter() - t
+    print(f"{label:12s} {t * 1e3:8.1f} ms  {len(snippets) / t:8.1f} snippets/s")
+    return objs
+
+with tempfile.TemporaryDirectory() as cache:
+    ARMAsm.CACHE_DIR = ""
+    single = timed("one by one", lambda: [ARMAsm(s, a) for s, a in snippets])
+    batch = timed("batch", lambda: ARMAsm.batch(snippets))
+    assert [c.data for c in single] == [c.data for c in batch]
+
+    ARMAsm.CACHE_DIR = cache
+    ARMAsm.batch(snippets)
+    cached = timed("cached", lambda: [ARMAsm(s, a) for s, a in snippets])
+    assert [c.data for c in single] == [c.data for c in cached]
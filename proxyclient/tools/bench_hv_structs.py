@@ -0,0 +1,34 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+import sys, pathlib
+sys.path.append(str(pathlib.Path(__file__).resolve().parents[1]))
+
+import os
+
+from m1n1 import bench
+from m1n1.proxy import ExcInfo
+from m1n1.utils import Register
+from m1n1.hv.types import EvtMMIOTrace, EvtIRQTrace, VMProxyHookData
+
+parser = bench.parser('Decode rate of the per-event hypervisor structures',
+                      'events', 20000, 'events decoded per measurement')
+args = parser.parse_args()
+
+def sample(st):
+    # Random payload, but with register fields cleared so that enum-typed fields decode
+    obj = st.parse(os.urandom(st.sizeof()))
+    for k, v in obj.items():
+        if isinstance(v, Register):
+            obj[k] = type(v)(0)
+    return st.build(obj)
+
+for name, st in (("ExcInfo", ExcInfo), ("EvtMMIOTrace", EvtMMIOTrace),
+                 ("EvtIRQTrace", EvtIRQTrace), ("VMProxyHookData", VMProxyHookData)):
+    samples = [sample(st) for i in range(args.events)]
+
+    for s in samples[:100]:
+        assert st.build(st.parse(s)) == s == st.subcon.build(st.subcon.parse(s))
+
+    slow = bench.rate(st.subcon.parse, samples[:max(1, args.events // 20)])
+    fast = bench.rate(st.parse, samples)
+    print(f"{name:16s} construct {slow:10.0f} ev/s   struct {fast:10.0f} ev/s   ({fast / slow:.1f}x)")
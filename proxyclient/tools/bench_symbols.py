@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+import sys, pathlib
+sys.path.append(str(pathlib.Path(__file__).resolve().parents[1]))
+
+import argparse, bisect, random, time
+
+from m1n1.utils import SymbolIndex
+
+parser = argparse.ArgumentParser(description='Address -> symbol lookup rate for HV tracing')
+parser.add_argument('-s', '--symbols', type=int, default=300000, help='symbols loaded (XNU + kexts)')
+parser.add_argument('-n', '--lookups', type=int, default=500000, help='lookups per measurement')
+parser.add_argument('-p', '--pcs', type=int, default=2000, help='distinct PCs seen by the trace')
+args = parser.parse_args()
+
+base = 0xfffffe0007004000
+symbols = [(base + random.randrange(0, 0x4000000) & ~3, f"com.apple.kernel:_sym{i}")
+           for i in range(args.symbols)]
+
+def tuple_lookup(table, addr):
+    # Previous scheme: bisect over a sorted list of (addr, name) tuples
+    idx = bisect.bisect_left(table, (addr + 1, "")) - 1
+    if idx < 0 or idx >= len(table):
+        return None, None
+    return table[idx]
+
+t = time.perf_counter()
+table = sorted(symbols)
+t_tuple = time.perf_counter() - t
+t = time.perf_counter()
+index = SymbolIndex(symbols)
+t_index = time.perf_counter() - t
+print(f"build: tuple list {t_tuple * 1e3:7.1f} ms   SymbolIndex {t_index * 1e3:7.1f} ms")
+
+pcs = [base + random.randrange(0, 0x4000000) for i in range(args.pcs)]
+trace = [random.choice(pcs) for i in range(args.lookups)]
+for pc in pcs:
+    assert tuple_lookup(table, pc) == index.lookup(pc)
+
+def rate(fn):
+    t = time.perf_counter()
+    for pc in trace:
+        fn(pc)
+    return len(trace) / (time.perf_counter() - t)
+
+old = rate(lambda pc: tuple_lookup(table, pc))
+uncached = rate(lambda pc: index._lookup(pc))
+new = rate(lambda pc: index.lookup(pc))
+print(f"lookup: tuple bisect {old:10.0f}/s   int bisect {uncached:10.0f}/s   "
+      f"with LRU {new:10.0f}/s ({new / old:.1f}x)")
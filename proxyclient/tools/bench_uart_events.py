@@ -0,0 +1,53 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+import sys, pathlib
+sys.path.append(str(pathlib.Path(__file__).resolve().parents[1]))
+
+import time
+
+from m1n1 import bench
+from m1n1.proxy import UartInterface, EVENT
+from m1n1.hv.types import EvtMMIOTrace
+from m1n1.sim import ProxySim
+
+parser = bench.parser('Proxy request latency under an MMIO trace event flood, against tools/proxysim',
+                      'requests', 2000, 'proxy requests per run')
+parser.add_argument('-e', '--event-rate', type=int, default=20000, help='simulated events/sec')
+parser.add_argument('-r', '--read-size', type=int, default=4096, help='bytes per memory read')
+args = parser.parse_args()
+
+RAM = 0x800000000
+
+def run(use_reader):
+    with ProxySim(event_rate=args.event_rate) as sim:
+        iface = UartInterface(sim.device)
+        handled = 0
+        def on_mmiotrace(data):
+            nonlocal handled
+            EvtMMIOTrace.parse(data)
+            handled += 1
+        iface.set_event_handler(EVENT.MMIOTRACE, on_mmiotrace)
+        iface.nop()
+        if use_reader:
+            iface.start_reader()
+
+        lat = []
+        t0 = time.perf_counter()
+        for i in range(args.requests):
+            if i & 1:
+                lat.append(bench.timed(iface.readmem, RAM, args.read_size)[1])
+            else:
+                lat.append(bench.timed(iface.proxyreq, bytes(56))[1])
+        elapsed = time.perf_counter() - t0
+
+        iface.drain_events()
+        iface.stop_reader()
+
+    lat.sort()
+    mode = "reader thread" if use_reader else "synchronous"
+    print(f"{mode:14s} {args.requests / elapsed:8.0f} req/s  "
+          f"p50 {bench.percentile(lat, 50) * 1e6:7.1f} us  "
+          f"p99 {bench.percentile(lat, 99) * 1e6:8.1f} us  {handled / elapsed:8.0f} events/s handled")
+
+run(False)
+run(True)
@@ -10,7 +10,7 @@ parser = argparse.ArgumentParser(description='(Linux) kernel loader for m1n1')
 parser.add_argument('payload', type=pathlib.Path)
 parser.add_argument('dtb', type=pathlib.Path)
 parser.add_argument('initramfs', nargs='?', type=pathlib.Path)
-parser.add_argument('--compression', choices=['auto', 'none', 'gz', 'xz'], default='auto')
+parser.add_argument('--compression', choices=['auto', 'none', 'gz', 'xz', 'lz4'], default='auto')
 parser.add_argument('-b', '--bootargs', type=str, metavar='"boot arguments"')
 parser.add_argument('-t', '--tty', type=str)
 parser.add_argument('-u', '--u-boot', type=pathlib.Path, help="load u-boot before linux")
@@ -25,6 +25,8 @@ if args.compression == 'auto':
         args.compression = 'gz'
     elif suffix == '.xz':
         args.compression = 'xz'
+    elif suffix == '.lz4':
+        args.compression = 'lz4'
     else:
         raise ValueError('unknown compression for {}'.format(args.payload))
 
@@ -142,6 +144,9 @@ elif args.compression == 'gz':
 elif args.compression == 'xz':
     print("Uncompressing xz ...")
     kernel_size = p.xzdec(compressed_addr, compressed_size, kernel_base, kernel_size)
+elif args.compression == 'lz4':
+    print("Uncompressing lz4 ...")
+    kernel_size = p.lz4dec(compressed_addr, compressed_size, kernel_base, kernel_size)
 else:
     raise ValueError('unsupported compression {}'.format(args.compression))
 
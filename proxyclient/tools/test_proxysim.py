@@ -0,0 +1,37 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+"""Protocol regression tests for the proxyclient stack, run against tools/proxysim."""
+import sys, pathlib
+sys.path.append(str(pathlib.Path(__file__).resolve().parents[1]))
+
+from m1n1.proxy import UartInterface, M1N1Proxy
+from m1n1.proxyutils import ProxyUtils
+from m1n1.sim import ProxySim
+
+RAM = 0x800000000
+
+def test_memdiff_fault_not_pending(p, u):
+    '''a faulting memdiff32 reports ~0 and must not leave an exception pending'''
+    snap = u.malloc(16)
+    out = u.malloc(16)
+    assert p.memdiff32(0x10, snap, 16, out, 16) == -1
+    u.read(RAM, 32)
+    u.write(RAM, 0, 32)
+    p.check_exc()
+
+TESTS = [test_memdiff_fault_not_pending]
+
+if __name__ == "__main__":
+    failed = 0
+    with ProxySim() as sim:
+        iface = UartInterface(sim.device)
+        p = M1N1Proxy(iface)
+        u = ProxyUtils(p)
+        for test in TESTS:
+            try:
+                test(p, u)
+                print(f"PASS {test.__name__}")
+            except Exception as e:
+                failed += 1
+                print(f"FAIL {test.__name__}: {e!r}")
+    sys.exit(1 if failed else 0)
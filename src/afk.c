@@ -1,11 +1,24 @@
 /* SPDX-License-Identifier: MIT */
 
+// #define AFK_TRACE
+
 #include "afk.h"
 #include "assert.h"
 #include "malloc.h"
 #include "string.h"
 #include "utils.h"
 
+#ifdef AFK_TRACE
+#define trace_printf printf
+#else
+#define trace_printf(...)                                                                          \
+    do {                                                                                           \
+    } while (0)
+#endif
+
+/* must be a power of two so that tags keep mapping to the same slot when they wrap */
+#define AFK_EPIC_MAX_PENDING 8
+
 struct afk_rb_hdr {
     u32 bufsz;
     u32 unk;
@@ -81,6 +94,18 @@ struct epic_cmd {
     u32 txlen;
 } PACKED;
 
+struct afk_epic_cmd {
+    bool pending;
+    bool done;
+    u16 tag;
+    u16 code;
+    int channel;
+    int retcode;
+    void *rxbuf;
+    size_t rxsize;
+    u64 submit_ticks;
+};
+
 struct afk_epic_ep {
     int ep;
     rtkit_dev_t *rtk;
@@ -91,8 +116,23 @@ struct afk_epic_ep {
     struct afk_rb tx;
     struct afk_rb rx;
 
+    /* bumped by the RTKit endpoint handler, rx_kick is set on RBEP_RECV */
+    u32 msg_count;
+    bool rx_kick;
+
+    /* one tx/rx slot of txslot_sz/rxslot_sz per outstanding command */
     struct rtkit_buffer txbuf;
     struct rtkit_buffer rxbuf;
+    size_t txslot_sz;
+    size_t rxslot_sz;
+
+    /* outstanding commands, indexed by tag % AFK_EPIC_MAX_PENDING */
+    struct afk_epic_cmd cmds[AFK_EPIC_MAX_PENDING];
+    u16 next_tag;
+
+    /* tags of completed commands that were not reaped yet, in completion order */
+    u16 cq[AFK_EPIC_MAX_PENDING];
+    int cq_count;
 
     bool started;
 };
@@ -143,24 +183,8 @@ bool afk_rb_init(afk_epic_ep_t *epic, struct afk_rb *rb, u64 base, u64 size)
     return true;
 }
 
-static int afk_epic_poll(afk_epic_ep_t *epic)
+static int afk_epic_handle_msg(afk_epic_ep_t *epic, struct rtkit_message msg)
 {
-    int ret;
-    struct rtkit_message msg;
-
-    while ((ret = rtkit_recv(epic->rtk, &msg)) == 0)
-        ;
-
-    if (ret < 0) {
-        printf("EPIC: rtkit_recv failed!\n");
-        return ret;
-    }
-
-    if (msg.ep != epic->ep) {
-        printf("EPIC: received message for unexpected endpoint %d\n", msg.ep);
-        return 0;
-    }
-
     int type = FIELD_GET(RBEP_TYPE, msg.msg);
     u64 base, size, tag;
     switch (type) {
@@ -230,21 +254,49 @@ static int afk_epic_poll(afk_epic_ep_t *epic)
     return 0;
 }
 
-static int afk_epic_rx(afk_epic_ep_t *epic, struct afk_qe **qe)
+static int afk_epic_rtkit_handler(void *priv, const struct rtkit_message *msg)
+{
+    afk_epic_ep_t *epic = priv;
+
+    int ret = afk_epic_handle_msg(epic, *msg);
+    if (ret < 0)
+        return ret;
+
+    epic->msg_count++;
+    if (ret > 0)
+        epic->rx_kick = true;
+
+    return 0;
+}
+
+/* Waits for messages to this endpoint, returns 1 if one of them was RBEP_RECV */
+static int afk_epic_poll(afk_epic_ep_t *epic)
+{
+    u32 count = epic->msg_count;
+
+    while (epic->msg_count == count) {
+        int ret = rtkit_poll(epic->rtk);
+        if (ret < 0) {
+            printf("EPIC: rtkit_poll failed!\n");
+            return ret;
+        }
+    }
+
+    int kick = epic->rx_kick;
+    epic->rx_kick = false;
+    return kick;
+}
+
+/* Returns 1 and the next queue entry if there is one, 0 if the RX ring is empty */
+static int afk_epic_rx_peek(afk_epic_ep_t *epic, struct afk_qe **qe)
 {
-    int ret;
     struct afk_rb *rb = &epic->rx;
 
     u32 rptr = rb->hdr->rptr;
 
-    while (rptr == rb->hdr->wptr) {
-        do {
-            ret = afk_epic_poll(epic);
-            if (ret < 0)
-                return ret;
-        } while (ret == 0);
-        dma_rmb();
-    }
+    if (rptr == rb->hdr->wptr)
+        return 0;
+    dma_rmb();
 
     struct afk_qe *hdr = rb->buf + rptr;
 
@@ -268,6 +320,21 @@ static int afk_epic_rx(afk_epic_ep_t *epic, struct afk_qe **qe)
     return 1;
 }
 
+static int afk_epic_rx(afk_epic_ep_t *epic, struct afk_qe **qe)
+{
+    int ret;
+
+    while ((ret = afk_epic_rx_peek(epic, qe)) == 0) {
+        do {
+            ret = afk_epic_poll(epic);
+            if (ret < 0)
+                return ret;
+        } while (ret == 0);
+    }
+
+    return ret;
+}
+
 static int afk_epic_tx(afk_epic_ep_t *epic, u32 channel, u32 type, void *data, size_t size)
 {
     struct afk_rb *rb = &epic->tx;
@@ -347,17 +414,107 @@ static void afk_epic_rx_ack(afk_epic_ep_t *epic)
     rb->hdr->rptr = rptr;
 }
 
-int afk_epic_command(afk_epic_ep_t *epic, int channel, u16 code, void *txbuf, size_t txsize,
-                     void *rxbuf, size_t *rxsize)
+static int afk_epic_handle_reply(afk_epic_ep_t *epic, struct afk_qe *qe)
+{
+    if (qe->type != TYPE_REPLY && qe->type != TYPE_NOTIFY) {
+        printf("EPIC: got unexpected message type %d during command\n", qe->type);
+        return 0;
+    }
+
+    struct epic_hdr *hdr = (void *)(qe + 1);
+    struct epic_sub_hdr *sub = (void *)(hdr + 1);
+
+    if (sub->category != CAT_REPLY) {
+        printf("EPIC: got unexpected message %02x:%04x during command\n", sub->category,
+               sub->code);
+        return 0;
+    }
+
+    int slot = sub->seq % AFK_EPIC_MAX_PENDING;
+    struct afk_epic_cmd *cmd = &epic->cmds[slot];
+
+    if (!cmd->pending || cmd->tag != sub->seq || cmd->code != sub->code ||
+        cmd->channel != (int)qe->channel) {
+        printf("EPIC: got reply %04x for unknown command tag %d\n", sub->code, sub->seq);
+        return 0;
+    }
+
+    struct epic_cmd *rcmd = (void *)(sub + 1);
+
+    cmd->retcode = rcmd->retcode; // should be negative already
+    if (cmd->retcode != 0) {
+        printf("EPIC: IOP returned 0x%x\n", rcmd->retcode);
+    } else if (rcmd->rxlen > cmd->rxsize) {
+        printf("EPIC: reply too large (0x%x > 0x%lx)\n", rcmd->rxlen, cmd->rxsize);
+        cmd->retcode = -1;
+    } else {
+        cmd->rxsize = rcmd->rxlen;
+        if (cmd->rxsize && rcmd->rxbuf && cmd->rxbuf)
+            memcpy(cmd->rxbuf, epic->rxbuf.bfr + slot * epic->rxslot_sz, cmd->rxsize);
+    }
+
+    trace_printf("EPIC: ep 0x%x command %04x tag %d took %ld us\n", epic->ep, cmd->code, cmd->tag,
+                 ticks_to_usecs(get_ticks() - cmd->submit_ticks));
+
+    cmd->pending = false;
+    cmd->done = true;
+    epic->cq[epic->cq_count++] = cmd->tag;
+
+    return 1;
+}
+
+int afk_epic_poll_all(afk_epic_ep_t *epic)
+{
+    int ret, completed = 0;
+
+    while ((ret = rtkit_poll(epic->rtk)) > 0)
+        ;
+
+    if (ret < 0) {
+        printf("EPIC: rtkit_poll failed!\n");
+        return ret;
+    }
+    epic->rx_kick = false;
+
+    /* the ring is shared memory, so replies can be picked up without waiting for RBEP_RECV */
+    struct afk_qe *qe;
+    while ((ret = afk_epic_rx_peek(epic, &qe)) > 0) {
+        completed += afk_epic_handle_reply(epic, qe);
+        afk_epic_rx_ack(epic);
+    }
+
+    return ret < 0 ? ret : completed;
+}
+
+int afk_epic_submit(afk_epic_ep_t *epic, int channel, u16 code, void *txbuf, size_t txsize,
+                    void *rxbuf, size_t rxsize)
 {
     struct {
         struct epic_hdr hdr;
         struct epic_sub_hdr sub;
         struct epic_cmd cmd;
     } PACKED msg;
+    struct afk_epic_cmd *cmd = NULL;
+    u16 tag = 0;
+
+    assert(txsize <= epic->txslot_sz);
+    assert(rxsize <= epic->rxslot_sz);
+
+    for (int i = 0; i < AFK_EPIC_MAX_PENDING; i++) {
+        tag = epic->next_tag + i;
+        cmd = &epic->cmds[tag % AFK_EPIC_MAX_PENDING];
+        if (!cmd->pending && !cmd->done)
+            break;
+        cmd = NULL;
+    }
+
+    if (!cmd) {
+        printf("EPIC: too many outstanding commands\n");
+        return -1;
+    }
 
-    assert(txsize <= epic->txbuf.sz);
-    assert(!rxsize || *rxsize <= epic->rxbuf.sz);
+    int slot = tag % AFK_EPIC_MAX_PENDING;
+    epic->next_tag = tag + 1;
 
     memset(&msg, 0, sizeof(msg));
 
@@ -367,63 +524,95 @@ int afk_epic_command(afk_epic_ep_t *epic, int channel, u16 code, void *txbuf, si
     msg.sub.version = 3;
     msg.sub.category = CAT_COMMAND;
     msg.sub.code = code;
-    msg.sub.seq = 0;
-    msg.cmd.txbuf = epic->txbuf.dva;
+    msg.sub.seq = tag;
+    msg.cmd.txbuf = epic->txbuf.dva + slot * epic->txslot_sz;
     msg.cmd.txlen = txsize;
-    msg.cmd.rxbuf = epic->rxbuf.dva;
-    msg.cmd.rxlen = rxsize ? *rxsize : 0;
-
-    memcpy(epic->txbuf.bfr, txbuf, txsize);
+    msg.cmd.rxbuf = epic->rxbuf.dva + slot * epic->rxslot_sz;
+    msg.cmd.rxlen = rxsize;
+
+    memcpy(epic->txbuf.bfr + slot * epic->txslot_sz, txbuf, txsize);
+
+    *cmd = (struct afk_epic_cmd){
+        .pending = true,
+        .tag = tag,
+        .code = code,
+        .channel = channel,
+        .rxbuf = rxbuf,
+        .rxsize = rxsize,
+        .submit_ticks = get_ticks(),
+    };
 
     int ret = afk_epic_tx(epic, channel, TYPE_COMMAND, &msg, sizeof msg);
     if (ret < 0) {
         printf("EPIC: failed to transmit command\n");
+        cmd->pending = false;
         return ret;
     }
 
-    struct afk_qe *rmsg;
-    struct epic_cmd *rcmd;
-
-    while (true) {
-        ret = afk_epic_rx(epic, &rmsg);
-        if (ret < 0)
-            return ret;
+    return tag;
+}
 
-        if (rmsg->type != TYPE_REPLY && rmsg->type != TYPE_NOTIFY) {
-            printf("EPIC: got unexpected message type %d during command\n", rmsg->type);
-            afk_epic_rx_ack(epic);
-            continue;
+static int afk_epic_retire(afk_epic_ep_t *epic, struct afk_epic_cmd *cmd, size_t *rxsize)
+{
+    for (int i = 0; i < epic->cq_count; i++) {
+        if (epic->cq[i] == cmd->tag) {
+            memmove(&epic->cq[i], &epic->cq[i + 1], (epic->cq_count - i - 1) * sizeof(u16));
+            epic->cq_count--;
+            break;
         }
+    }
 
-        struct epic_hdr *hdr = (void *)(rmsg + 1);
-        struct epic_sub_hdr *sub = (void *)(hdr + 1);
+    cmd->done = false;
+    if (rxsize)
+        *rxsize = cmd->rxsize;
 
-        if (sub->category != CAT_REPLY || sub->code != code) {
-            printf("EPIC: got unexpected message %02x:%04x during command\n", sub->category,
-                   sub->code);
-            afk_epic_rx_ack(epic);
-            continue;
-        }
+    return cmd->retcode;
+}
 
-        rcmd = (void *)(sub + 1);
-        break;
+int afk_epic_wait(afk_epic_ep_t *epic, int tag, size_t *rxsize)
+{
+    struct afk_epic_cmd *cmd = &epic->cmds[tag % AFK_EPIC_MAX_PENDING];
+
+    if (tag < 0 || cmd->tag != tag || !(cmd->pending || cmd->done)) {
+        printf("EPIC: waiting for unknown command tag %d\n", tag);
+        return -1;
     }
 
-    if (rcmd->retcode != 0) {
-        printf("EPIC: IOP returned 0x%x\n", rcmd->retcode);
-        afk_epic_rx_ack(epic);
-        return rcmd->retcode; // should be negative already
+    while (!cmd->done) {
+        int ret = afk_epic_poll_all(epic);
+        if (ret < 0)
+            return ret;
     }
 
-    assert(*rxsize >= rcmd->rxlen);
-    *rxsize = rcmd->rxlen;
+    return afk_epic_retire(epic, cmd, rxsize);
+}
 
-    if (rxsize && *rxsize && rcmd->rxbuf)
-        memcpy(rxbuf, epic->rxbuf.bfr, *rxsize);
+int afk_epic_reap(afk_epic_ep_t *epic, int *tag, int *retcode, size_t *rxsize)
+{
+    if (!epic->cq_count) {
+        int ret = afk_epic_poll_all(epic);
+        if (ret < 0)
+            return ret;
+        if (!epic->cq_count)
+            return 0;
+    }
 
-    afk_epic_rx_ack(epic);
+    struct afk_epic_cmd *cmd = &epic->cmds[epic->cq[0] % AFK_EPIC_MAX_PENDING];
 
-    return 0;
+    *tag = cmd->tag;
+    *retcode = afk_epic_retire(epic, cmd, rxsize);
+
+    return 1;
+}
+
+int afk_epic_command(afk_epic_ep_t *epic, int channel, u16 code, void *txbuf, size_t txsize,
+                     void *rxbuf, size_t *rxsize)
+{
+    int tag = afk_epic_submit(epic, channel, code, txbuf, txsize, rxbuf, rxsize ? *rxsize : 0);
+    if (tag < 0)
+        return tag;
+
+    return afk_epic_wait(epic, tag, rxsize);
 }
 
 afk_epic_ep_t *afk_epic_init(rtkit_dev_t *rtk, int endpoint)
@@ -436,6 +625,9 @@ afk_epic_ep_t *afk_epic_init(rtkit_dev_t *rtk, int endpoint)
     epic->ep = endpoint;
     epic->rtk = rtk;
 
+    if (!rtkit_register_ep(rtk, endpoint, afk_epic_rtkit_handler, epic))
+        goto err;
+
     if (!rtkit_start_ep(rtk, endpoint)) {
         printf("EPIC: failed to start endpoint %d\n", endpoint);
         goto err;
@@ -458,6 +650,7 @@ afk_epic_ep_t *afk_epic_init(rtkit_dev_t *rtk, int endpoint)
     return epic;
 
 err:
+    rtkit_register_ep(rtk, endpoint, NULL, NULL);
     free(epic);
     return NULL;
 }
@@ -476,6 +669,8 @@ int afk_epic_shutdown(afk_epic_ep_t *epic)
             break;
     }
 
+    rtkit_register_ep(epic->rtk, epic->ep, NULL, NULL);
+
     rtkit_free_buffer(epic->rtk, &epic->buf);
     rtkit_free_buffer(epic->rtk, &epic->rxbuf);
     rtkit_free_buffer(epic->rtk, &epic->txbuf);
@@ -529,12 +724,15 @@ int afk_epic_start_interface(afk_epic_ep_t *epic, char *name, size_t txsize, siz
         return -1;
     }
 
-    if (!rtkit_alloc_buffer(epic->rtk, &epic->rxbuf, rxsize)) {
+    epic->rxslot_sz = ALIGN_UP(rxsize, 1 << BLOCK_SHIFT);
+    epic->txslot_sz = ALIGN_UP(txsize, 1 << BLOCK_SHIFT);
+
+    if (!rtkit_alloc_buffer(epic->rtk, &epic->rxbuf, epic->rxslot_sz * AFK_EPIC_MAX_PENDING)) {
         printf("EPIC: failed to allocate rx buffer\n");
         return -1;
     }
 
-    if (!rtkit_alloc_buffer(epic->rtk, &epic->txbuf, txsize)) {
+    if (!rtkit_alloc_buffer(epic->rtk, &epic->txbuf, epic->txslot_sz * AFK_EPIC_MAX_PENDING)) {
         printf("EPIC: failed to allocate tx buffer\n");
         return -1;
     }
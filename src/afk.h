@@ -14,4 +14,15 @@ int afk_epic_start_interface(afk_epic_ep_t *epic, char *name, size_t insize, siz
 int afk_epic_command(afk_epic_ep_t *epic, int channel, u16 code, void *txbuf, size_t txsize,
                      void *rxbuf, size_t *rxsize);
 
+/*
+ * Asynchronous commands: afk_epic_submit() returns a tag, the reply is collected with
+ * afk_epic_wait() for that tag or afk_epic_reap() for whichever command finished first.
+ * rxbuf must stay valid until then.
+ */
+int afk_epic_submit(afk_epic_ep_t *epic, int channel, u16 code, void *txbuf, size_t txsize,
+                    void *rxbuf, size_t rxsize);
+int afk_epic_wait(afk_epic_ep_t *epic, int tag, size_t *rxsize);
+int afk_epic_reap(afk_epic_ep_t *epic, int *tag, int *retcode, size_t *rxsize);
+int afk_epic_poll_all(afk_epic_ep_t *epic);
+
 #endif
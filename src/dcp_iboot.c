@@ -41,6 +41,17 @@ struct dcp_iboot_if {
         u8 rxbuf[RXBUF_LEN];
         struct rxcmd rxcmd;
     };
+
+    /* second command buffer, so that independent queries can be in flight at the same time */
+    union {
+        u8 aux_txbuf[TXBUF_LEN];
+        struct txcmd aux_txcmd;
+    };
+
+    union {
+        u8 aux_rxbuf[RXBUF_LEN];
+        struct rxcmd aux_rxcmd;
+    };
 };
 
 enum IBootCmd {
@@ -134,16 +145,25 @@ int dcp_ib_shutdown(dcp_iboot_if_t *iboot)
     return 0;
 }
 
-static int dcp_ib_cmd(dcp_iboot_if_t *iboot, int op, size_t in_size)
+static int dcp_ib_submit(dcp_iboot_if_t *iboot, struct txcmd *txcmd, void *rxbuf, int op,
+                         size_t in_size)
 {
-    size_t rxsize = RXBUF_LEN;
     assert(in_size <= TXBUF_LEN - sizeof(struct txcmd));
 
-    iboot->txcmd.op = op;
-    iboot->txcmd.len = sizeof(struct txcmd) + in_size;
+    txcmd->op = op;
+    txcmd->len = sizeof(struct txcmd) + in_size;
+
+    return afk_epic_submit(iboot->epic, iboot->channel, 0xc0, txcmd,
+                           sizeof(struct txcmd) + in_size, rxbuf, RXBUF_LEN);
+}
+
+static int dcp_ib_cmd(dcp_iboot_if_t *iboot, int op, size_t in_size)
+{
+    int tag = dcp_ib_submit(iboot, &iboot->txcmd, iboot->rxbuf, op, in_size);
+    if (tag < 0)
+        return tag;
 
-    return afk_epic_command(iboot->epic, iboot->channel, 0xc0, iboot->txbuf,
-                            sizeof(struct txcmd) + in_size, iboot->rxbuf, &rxsize);
+    return afk_epic_wait(iboot->epic, tag, NULL);
 }
 
 int dcp_ib_set_power(dcp_iboot_if_t *iboot, bool power)
@@ -194,6 +214,34 @@ int dcp_ib_get_color_modes(dcp_iboot_if_t *iboot, dcp_color_mode_t **modes)
     return resp->count;
 }
 
+int dcp_ib_get_modes(dcp_iboot_if_t *iboot, dcp_timing_mode_t **tmodes, int *timing_cnt,
+                     dcp_color_mode_t **cmodes, int *color_cnt)
+{
+    struct get_tmode_resp *tresp = (void *)iboot->rxcmd.payload;
+    struct get_cmode_resp *cresp = (void *)iboot->aux_rxcmd.payload;
+
+    int ttag = dcp_ib_submit(iboot, &iboot->txcmd, iboot->rxbuf, IBOOT_GET_TIMING_MODES, 0);
+    if (ttag < 0)
+        return ttag;
+
+    int ctag = dcp_ib_submit(iboot, &iboot->aux_txcmd, iboot->aux_rxbuf, IBOOT_GET_COLOR_MODES, 0);
+    int ret = afk_epic_wait(iboot->epic, ttag, NULL);
+    if (ctag < 0)
+        return ctag;
+
+    int cret = afk_epic_wait(iboot->epic, ctag, NULL);
+    if (ret < 0)
+        return ret;
+    if (cret < 0)
+        return cret;
+
+    *tmodes = tresp->modes;
+    *timing_cnt = tresp->count;
+    *cmodes = cresp->modes;
+    *color_cnt = cresp->count;
+    return 0;
+}
+
 int dcp_ib_set_mode(dcp_iboot_if_t *iboot, dcp_timing_mode_t *tmode, dcp_color_mode_t *cmode)
 {
     struct {
@@ -102,6 +102,8 @@ int dcp_ib_set_power(dcp_iboot_if_t *iboot, bool power);
 int dcp_ib_get_hpd(dcp_iboot_if_t *iboot, int *timing_cnt, int *color_cnt);
 int dcp_ib_get_timing_modes(dcp_iboot_if_t *iboot, dcp_timing_mode_t **modes);
 int dcp_ib_get_color_modes(dcp_iboot_if_t *iboot, dcp_color_mode_t **modes);
+int dcp_ib_get_modes(dcp_iboot_if_t *iboot, dcp_timing_mode_t **tmodes, int *timing_cnt,
+                     dcp_color_mode_t **cmodes, int *color_cnt);
 int dcp_ib_set_mode(dcp_iboot_if_t *iboot, dcp_timing_mode_t *timing, dcp_color_mode_t *color);
 int dcp_ib_swap_begin(dcp_iboot_if_t *iboot);
 int dcp_ib_swap_set_layer(dcp_iboot_if_t *iboot, int layer_id, dcp_layer_t *layer,
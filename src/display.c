@@ -334,19 +334,15 @@ int display_configure(const char *config)
 
     // Find best modes
     dcp_timing_mode_t *tmodes, tbest;
-    if ((ret = dcp_ib_get_timing_modes(iboot, &tmodes)) < 0) {
-        printf("display: failed to get timing modes\n");
-        return -1;
-    }
-    assert(ret == timing_cnt);
-    display_choose_timing_mode(tmodes, timing_cnt, &tbest, &want);
-
     dcp_color_mode_t *cmodes, cbest;
-    if ((ret = dcp_ib_get_color_modes(iboot, &cmodes)) < 0) {
-        printf("display: failed to get color modes\n");
+    int tmode_cnt, cmode_cnt;
+    if ((ret = dcp_ib_get_modes(iboot, &tmodes, &tmode_cnt, &cmodes, &cmode_cnt)) < 0) {
+        printf("display: failed to get timing/color modes\n");
         return -1;
     }
-    assert(ret == color_cnt);
+    assert(tmode_cnt == timing_cnt);
+    assert(cmode_cnt == color_cnt);
+    display_choose_timing_mode(tmodes, timing_cnt, &tbest, &want);
     display_choose_color_mode(cmodes, color_cnt, &cbest);
 
     // Set mode
@@ -371,7 +367,9 @@ int display_configure(const char *config)
         }
 
         fb_pa = top_of_memory_alloc(size);
-        memset((void *)fb_pa, 0, size);
+        // At boot the secondaries are not up yet, so this is a DC ZVA clear on the boot CPU
+        // only. It is only spread out when called later via the proxy with workers running.
+        memzero_parallel((void *)fb_pa, size);
 
         tmp_dva = iova_alloc(dcp->iovad_dcp, size);
 
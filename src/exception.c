@@ -20,6 +20,8 @@ extern char _el1_vectors_start[0];
 
 volatile enum exc_guard_t exc_guard = GUARD_OFF;
 volatile int exc_count = 0;
+volatile u64 exc_last_esr = 0;
+volatile u64 exc_last_far = 0;
 
 void el0_ret(void);
 void el1_ret(void);
@@ -291,6 +293,8 @@ void exc_sync(u64 *regs)
             flush_and_reboot();
     }
 
+    exc_last_esr = esr;
+    exc_last_far = in_gl ? mrs(SYS_IMP_APL_FAR_GL1) : (el12 ? mrs(FAR_EL12) : mrs(FAR_EL1));
     exc_count++;
 
     if (!(exc_guard & GUARD_SILENT))
@@ -388,6 +392,8 @@ void exc_serr(u64 *regs)
         flush_and_reboot();
     }
 
+    exc_last_esr = mrs(ESR_EL1);
+    exc_last_far = 0;
     exc_count++;
 
     sysop("dsb sy");
@@ -12,6 +12,9 @@
 
 #define FB_DEPTH_MASK 0xff
 
+// Minimum time between console renders while output is streaming in
+#define FB_CONSOLE_RENDER_INTERVAL_US 20000
+
 fb_t fb;
 
 struct image {
@@ -20,6 +23,11 @@ struct image {
     u32 height;
 };
 
+struct fb_console_span {
+    u16 start;
+    u16 end;
+};
+
 static struct {
     struct {
         u8 *ptr;
@@ -40,6 +48,18 @@ static struct {
         u32 cols;
     } margin;
 
+    /*
+     * Writes only update the character grid. Changed cells and scrolling are
+     * rendered to the framebuffer in batches by fb_console_render().
+     */
+    struct {
+        u8 *cells;                     /* max_row * max_col characters */
+        struct fb_console_span *dirty; /* per-row columns not yet rendered */
+        u32 scroll;                    /* rows scrolled since the last render */
+        bool pending;
+        u64 deadline;
+    } grid;
+
     bool initialized;
     bool active;
 } console;
@@ -65,33 +85,80 @@ const struct image logo_256 = {
 const struct image *logo;
 struct image orig_logo;
 
+/* Range of framebuffer lines modified since the last fb_update() */
+static struct {
+    u32 top;
+    u32 bottom;
+} dirty;
+
+static inline void fb_mark_dirty(u32 y, u32 h)
+{
+    dirty.top = min(dirty.top, y);
+    dirty.bottom = max(dirty.bottom, y + h);
+}
+
 void fb_update(void)
 {
-    memcpy128(fb.hwptr, fb.ptr, fb.size);
+    if (dirty.top >= dirty.bottom)
+        return;
+
+    size_t start = ALIGN_DOWN((size_t)dirty.top * fb.stride * 4, 16);
+    size_t end = min(ALIGN_UP((size_t)dirty.bottom * fb.stride * 4, 16), (size_t)fb.size);
+
+    memcpy128((u8 *)fb.hwptr + start, (u8 *)fb.ptr + start, end - start);
+
+    dirty.top = fb.height;
+    dirty.bottom = 0;
 }
 
-static void fb_clear_font_row(u32 row)
+static inline u32 *fb_line(u32 y)
 {
-    const u32 row_size = (console.margin.cols + console.cursor.max_col) * console.font.width * 4;
-    const u32 ystart = (console.margin.rows + row) * console.font.height * fb.stride;
+    return fb.ptr + y * fb.stride;
+}
+
+/* Fill w pixels using 64-bit stores where possible */
+static void fb_fill_line(u32 *p, u32 c, u32 w)
+{
+    if (((u64)p & 4) && w) {
+        *p++ = c;
+        w--;
+    }
 
-    for (u32 y = 0; y < console.font.height; ++y)
-        memset32(fb.ptr + ystart + y * fb.stride, 0, row_size);
+    memset64(p, ((u64)c << 32) | c, (w & ~1) * 4);
+
+    if (w & 1)
+        p[w - 1] = c;
 }
 
-static void fb_move_font_row(u32 dst, u32 src)
+static u32 fb_console_row_size(void)
 {
-    const u32 row_size = (console.margin.cols + console.cursor.max_col) * console.font.width * 4;
-    u32 ysrc = (console.margin.rows + src) * console.font.height;
-    u32 ydst = (console.margin.rows + dst) * console.font.height;
+    return (console.margin.cols + console.cursor.max_col) * console.font.width * 4;
+}
 
-    ysrc *= fb.stride;
-    ydst *= fb.stride;
+static void fb_clear_font_rows(u32 row, u32 n)
+{
+    const u32 row_size = fb_console_row_size();
+    const u32 ystart = (console.margin.rows + row) * console.font.height;
+    const u32 lines = n * console.font.height;
 
-    for (u32 y = 0; y < console.font.height; ++y)
-        memcpy32(fb.ptr + ydst + y * fb.stride, fb.ptr + ysrc + y * fb.stride, row_size);
+    for (u32 y = ystart; y < ystart + lines; ++y)
+        memset64(fb_line(y), 0, row_size);
 
-    fb_clear_font_row(src);
+    fb_mark_dirty(ystart, lines);
+}
+
+/* Move n console rows from src to dst (dst < src) in one pass over the lines */
+static void fb_move_font_rows(u32 dst, u32 src, u32 n)
+{
+    const u32 row_size = fb_console_row_size();
+    const u32 ysrc = (console.margin.rows + src) * console.font.height;
+    const u32 ydst = (console.margin.rows + dst) * console.font.height;
+    const u32 lines = n * console.font.height;
+
+    for (u32 y = 0; y < lines; ++y)
+        memcpy128(fb_line(ydst + y), fb_line(ysrc + y), row_size);
+
+    fb_mark_dirty(ydst, lines);
 }
 
 static inline u32 rgb2pixel_30(rgb_t c)
@@ -99,44 +166,42 @@ static inline u32 rgb2pixel_30(rgb_t c)
     return (c.b << 2) | (c.g << 12) | (c.r << 22);
 }
 
-static inline rgb_t pixel2rgb_30(u32 c)
+static inline u32 rgb2pixel_30_raw(u8 r, u8 g, u8 b)
 {
-    return (rgb_t){(c >> 22) & 0xff, (c >> 12) & 0xff, c >> 2};
+    return (b << 2) | (g << 12) | (r << 22);
 }
 
-static inline void fb_set_pixel(u32 x, u32 y, rgb_t c)
+static void fb_blit_line_xrgb(u32 *dst, const u8 *src, u32 w)
 {
-    fb.ptr[x + y * fb.stride] = rgb2pixel_30(c);
+    for (u32 j = 0; j < w; j++, src += 4)
+        dst[j] = rgb2pixel_30_raw(src[0], src[1], src[2]);
 }
 
-static inline rgb_t fb_get_pixel(u32 x, u32 y)
+static void fb_blit_line_xbgr(u32 *dst, const u8 *src, u32 w)
 {
-    return pixel2rgb_30(fb.ptr[x + y * fb.stride]);
+    for (u32 j = 0; j < w; j++, src += 4)
+        dst[j] = rgb2pixel_30_raw(src[2], src[1], src[0]);
 }
 
 void fb_blit(u32 x, u32 y, u32 w, u32 h, void *data, u32 stride, pix_fmt_t pix_fmt)
 {
     u8 *p = data;
-
-    for (u32 i = 0; i < h; i++) {
-        for (u32 j = 0; j < w; j++) {
-            rgb_t color;
-            switch (pix_fmt) {
-                default:
-                case PIX_FMT_XRGB:
-                    color.r = p[(j + i * stride) * 4];
-                    color.g = p[(j + i * stride) * 4 + 1];
-                    color.b = p[(j + i * stride) * 4 + 2];
-                    break;
-                case PIX_FMT_XBGR:
-                    color.r = p[(j + i * stride) * 4 + 2];
-                    color.g = p[(j + i * stride) * 4 + 1];
-                    color.b = p[(j + i * stride) * 4];
-                    break;
-            }
-            fb_set_pixel(x + j, y + i, color);
-        }
+    void (*blit_line)(u32 *dst, const u8 *src, u32 w);
+
+    switch (pix_fmt) {
+        default:
+        case PIX_FMT_XRGB:
+            blit_line = fb_blit_line_xrgb;
+            break;
+        case PIX_FMT_XBGR:
+            blit_line = fb_blit_line_xbgr;
+            break;
     }
+
+    for (u32 i = 0; i < h; i++)
+        blit_line(fb_line(y + i) + x, p + i * stride * 4, w);
+
+    fb_mark_dirty(y, h);
     fb_update();
 }
 
@@ -145,12 +210,15 @@ void fb_unblit(u32 x, u32 y, u32 w, u32 h, void *data, u32 stride)
     u8 *p = data;
 
     for (u32 i = 0; i < h; i++) {
-        for (u32 j = 0; j < w; j++) {
-            rgb_t color = fb_get_pixel(x + j, y + i);
-            p[(j + i * stride) * 4] = color.r;
-            p[(j + i * stride) * 4 + 1] = color.g;
-            p[(j + i * stride) * 4 + 2] = color.b;
-            p[(j + i * stride) * 4 + 3] = 0xff;
+        const u32 *src = fb_line(y + i) + x;
+        u8 *dst = p + i * stride * 4;
+
+        for (u32 j = 0; j < w; j++, dst += 4) {
+            u32 c = src[j];
+            dst[0] = c >> 22;
+            dst[1] = c >> 12;
+            dst[2] = c >> 2;
+            dst[3] = 0xff;
         }
     }
 }
@@ -159,14 +227,16 @@ void fb_fill(u32 x, u32 y, u32 w, u32 h, rgb_t color)
 {
     u32 c = rgb2pixel_30(color);
     for (u32 i = 0; i < h; i++)
-        memset32(&fb.ptr[x + (y + i) * fb.stride], c, w * 4);
+        fb_fill_line(fb_line(y + i) + x, c, w);
+    fb_mark_dirty(y, h);
     fb_update();
 }
 
 void fb_clear(rgb_t color)
 {
     u32 c = rgb2pixel_30(color);
-    memset32(fb.ptr, c, fb.stride * fb.height * 4);
+    fb_fill_line(fb.ptr, c, fb.stride * fb.height);
+    fb_mark_dirty(0, fb.height);
     fb_update();
 }
 
@@ -213,24 +283,68 @@ void fb_improve_logo(void)
     }
 }
 
-static inline rgb_t font_get_pixel(u8 c, u32 x, u32 y)
+static void fb_render_cell(u32 row, u32 col, u8 c)
+{
+    u32 x = (console.margin.cols + col) * console.font.width;
+    u32 y = (console.margin.rows + row) * console.font.height;
+    const u8 *glyph = console.font.ptr + (c - 0x20) * console.font.width * console.font.height;
+
+    for (u32 i = 0; i < console.font.height; i++) {
+        u32 *dst = fb_line(y + i) + x;
+
+        for (u32 j = 0; j < console.font.width; j++, glyph++)
+            dst[j] = rgb2pixel_30_raw(*glyph, *glyph, *glyph);
+    }
+}
+
+static void fb_console_render(void)
 {
-    c -= 0x20;
-    u8 v =
-        console.font.ptr[c * console.font.width * console.font.height + y * console.font.width + x];
+    const u32 max_row = console.cursor.max_row;
+    const u32 max_col = console.cursor.max_col;
+
+    if (console.grid.scroll >= max_row) {
+        fb_clear_font_rows(0, max_row);
+    } else if (console.grid.scroll) {
+        fb_move_font_rows(0, console.grid.scroll, max_row - console.grid.scroll);
+        fb_clear_font_rows(max_row - console.grid.scroll, console.grid.scroll);
+    }
+    console.grid.scroll = 0;
+
+    for (u32 row = 0; row < max_row; row++) {
+        struct fb_console_span *span = &console.grid.dirty[row];
+
+        if (span->start >= span->end)
+            continue;
+
+        for (u32 col = span->start; col < span->end; col++)
+            fb_render_cell(row, col, console.grid.cells[row * max_col + col]);
+
+        fb_mark_dirty((console.margin.rows + row) * console.font.height, console.font.height);
+        span->start = span->end = 0;
+    }
 
-    rgb_t col = {.r = v, .g = v, .b = v};
-    return col;
+    fb_update();
+
+    console.grid.pending = false;
+    console.grid.deadline = timeout_calculate(FB_CONSOLE_RENDER_INTERVAL_US);
 }
 
 static void fb_putbyte(u8 c)
 {
-    u32 x = (console.margin.cols + console.cursor.col) * console.font.width;
-    u32 y = (console.margin.rows + console.cursor.row) * console.font.height;
+    struct fb_console_span *span = &console.grid.dirty[console.cursor.row];
+    u32 col = console.cursor.col;
+
+    console.grid.cells[console.cursor.row * console.cursor.max_col + col] = c;
 
-    for (u32 i = 0; i < console.font.height; i++)
-        for (u32 j = 0; j < console.font.width; j++)
-            fb_set_pixel(x + j, y + i, font_get_pixel(c, j, i));
+    if (span->start >= span->end) {
+        span->start = col;
+        span->end = col + 1;
+    } else {
+        span->start = min(span->start, col);
+        span->end = max(span->end, col + 1);
+    }
+
+    console.grid.pending = true;
 }
 
 static void fb_putchar(u8 c)
@@ -259,20 +373,33 @@ static void fb_putchar(u8 c)
 
 void fb_console_scroll(u32 n)
 {
-    u32 row = 0;
+    const u32 max_row = console.cursor.max_row;
+    const u32 max_col = console.cursor.max_col;
+
     n = min(n, console.cursor.row);
-    for (; row < console.cursor.max_row - n; ++row)
-        fb_move_font_row(row, row + n);
-    for (; row < console.cursor.max_row; ++row)
-        fb_clear_font_row(row);
+    if (!n)
+        return;
+
+    memmove(console.grid.cells, console.grid.cells + n * max_col, (max_row - n) * max_col);
+    memset(console.grid.cells + (max_row - n) * max_col, ' ', n * max_col);
+    memmove(console.grid.dirty, console.grid.dirty + n,
+            (max_row - n) * sizeof(*console.grid.dirty));
+    memset(console.grid.dirty + max_row - n, 0, n * sizeof(*console.grid.dirty));
+
+    // The framebuffer contents are moved as a single block on the next render
+    console.grid.scroll = min(console.grid.scroll + n, max_row);
+    console.grid.pending = true;
     console.cursor.row -= n;
 }
 
 void fb_console_reserve_lines(u32 n)
 {
+    if (!console.initialized)
+        return;
+
     if ((console.cursor.max_row - console.cursor.row) <= n)
         fb_console_scroll(1 + n - (console.cursor.max_row - console.cursor.row));
-    fb_update();
+    fb_console_render();
 }
 
 ssize_t fb_console_write(const char *bfr, size_t len)
@@ -287,11 +414,18 @@ ssize_t fb_console_write(const char *bfr, size_t len)
         wrote++;
     }
 
-    fb_update();
+    if (timeout_expired(console.grid.deadline))
+        fb_console_render();
 
     return wrote;
 }
 
+/* Cheap check for idle loops, so they only go through the iodev layer when there is work */
+bool fb_console_pending(void)
+{
+    return console.initialized && console.grid.pending;
+}
+
 static bool fb_console_iodev_can_write(void *opaque)
 {
     UNUSED(opaque);
@@ -304,9 +438,19 @@ static ssize_t fb_console_iodev_write(void *opaque, const void *buf, size_t len)
     return fb_console_write(buf, len);
 }
 
+static void fb_console_iodev_flush(void *opaque)
+{
+    UNUSED(opaque);
+
+    if (fb_console_pending())
+        fb_console_render();
+}
+
 const struct iodev_ops iodev_fb_ops = {
     .can_write = fb_console_iodev_can_write,
     .write = fb_console_iodev_write,
+    .flush = fb_console_iodev_flush,
+    .handle_events = fb_console_iodev_flush,
 };
 
 struct iodev iodev_fb = {
@@ -317,8 +461,13 @@ struct iodev iodev_fb = {
 
 static void fb_clear_console(void)
 {
-    for (u32 row = 0; row < console.cursor.max_row; ++row)
-        fb_clear_font_row(row);
+    fb_clear_font_rows(0, console.cursor.max_row);
+
+    memset(console.grid.cells, ' ', console.cursor.max_row * console.cursor.max_col);
+    memset(console.grid.dirty, 0, console.cursor.max_row * sizeof(*console.grid.dirty));
+    console.grid.scroll = 0;
+    console.grid.pending = false;
+    console.grid.deadline = 0;
 
     console.cursor.col = 0;
     console.cursor.row = 0;
@@ -340,6 +489,8 @@ void fb_init(bool clear)
 
     fb.ptr = malloc(fb.size);
     memcpy(fb.ptr, fb.hwptr, fb.size);
+    dirty.top = fb.height;
+    dirty.bottom = 0;
 
     if (cur_boot_args.video.depth & FB_DEPTH_FLAG_RETINA) {
         logo = &logo_256;
@@ -360,8 +511,10 @@ void fb_init(bool clear)
                         &orig_logo);
     }
 
-    if (clear)
-        memset32(fb.ptr, 0, fb.size);
+    if (clear) {
+        fb_fill_line(fb.ptr, 0, fb.size / 4);
+        fb_mark_dirty(0, fb.height);
+    }
 
     console.margin.rows = 2;
     console.margin.cols = 4;
@@ -372,6 +525,9 @@ void fb_init(bool clear)
     console.cursor.max_col =
         ((fb.width - logo->width) / 2) / console.font.width - 2 * console.margin.cols;
 
+    console.grid.cells = malloc(console.cursor.max_row * console.cursor.max_col);
+    console.grid.dirty = malloc(console.cursor.max_row * sizeof(*console.grid.dirty));
+
     console.initialized = true;
     console.active = false;
 
@@ -401,6 +557,8 @@ void fb_shutdown(bool restore_logo)
         free(orig_logo.ptr);
         orig_logo.ptr = NULL;
     }
+    free(console.grid.cells);
+    free(console.grid.dirty);
     free(fb.ptr);
 }
 
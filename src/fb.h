@@ -53,5 +53,6 @@ void fb_improve_logo(void);
 void fb_console_scroll(u32 n);
 void fb_console_reserve_lines(u32 n);
 ssize_t fb_console_write(const char *bfr, size_t len);
+bool fb_console_pending(void);
 
 #endif
@@ -4,6 +4,7 @@
 #include "assert.h"
 #include "cpu_regs.h"
 #include "display.h"
+#include "fb.h"
 #include "gxf.h"
 #include "memory.h"
 #include "pcie.h"
@@ -375,4 +376,6 @@ void hv_tick(struct exc_info *ctx)
             hv_exc_proxy(ctx, START_HV, HV_USER_INTERRUPT, NULL);
     }
     hv_vuart_poll();
+    if (fb_console_pending())
+        iodev_handle_events(IODEV_FB);
 }
@@ -124,6 +124,36 @@ void iodev_flush(iodev_id_t id)
         spin_unlock(&iodevs[id]->lock);
 }
 
+/*
+ * The direct variants are only used for buffers in RAM, which the device may access by DMA.
+ * Without device support they are equivalent to iodev_read() and iodev_queue().
+ */
+ssize_t iodev_read_direct(iodev_id_t id, void *buf, size_t length)
+{
+    if (!iodevs[id] || !iodevs[id]->ops->read_direct)
+        return iodev_read(id, buf, length);
+
+    if (mmu_active())
+        spin_lock(&iodevs[id]->lock);
+    ssize_t ret = iodevs[id]->ops->read_direct(iodevs[id]->opaque, buf, length);
+    if (mmu_active())
+        spin_unlock(&iodevs[id]->lock);
+    return ret;
+}
+
+ssize_t iodev_write_direct(iodev_id_t id, const void *buf, size_t length)
+{
+    if (!iodevs[id] || !iodevs[id]->ops->write_direct)
+        return iodev_queue(id, buf, length);
+
+    if (mmu_active())
+        spin_lock(&iodevs[id]->lock);
+    ssize_t ret = iodevs[id]->ops->write_direct(iodevs[id]->opaque, buf, length);
+    if (mmu_active())
+        spin_unlock(&iodevs[id]->lock);
+    return ret;
+}
+
 void iodev_lock(iodev_id_t id)
 {
     if (!iodevs[id])
@@ -29,6 +29,9 @@ struct iodev_ops {
     ssize_t (*queue)(void *opaque, const void *buf, size_t length);
     void (*flush)(void *opaque);
     void (*handle_events)(void *opaque);
+    /* optional: move large buffers without going through the driver's own buffering */
+    ssize_t (*read_direct)(void *opaque, void *buf, size_t length);
+    ssize_t (*write_direct)(void *opaque, const void *buf, size_t length);
 };
 
 struct iodev {
@@ -48,6 +51,8 @@ ssize_t iodev_read(iodev_id_t id, void *buf, size_t length);
 ssize_t iodev_write(iodev_id_t id, const void *buf, size_t length);
 ssize_t iodev_queue(iodev_id_t id, const void *buf, size_t length);
 void iodev_flush(iodev_id_t id);
+ssize_t iodev_read_direct(iodev_id_t id, void *buf, size_t length);
+ssize_t iodev_write_direct(iodev_id_t id, const void *buf, size_t length);
 void iodev_handle_events(iodev_id_t id);
 void iodev_lock(iodev_id_t id);
 void iodev_unlock(iodev_id_t id);
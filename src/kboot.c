@@ -38,6 +38,7 @@ static int dt_bufsize = 0;
 static void *initrd_start = NULL;
 static size_t initrd_size = 0;
 static char *chosen_params[MAX_CHOSEN_PARAMS][2];
+static bool dt_verbose = false;
 
 extern const char *const m1n1_version;
 
@@ -58,6 +59,225 @@ int dt_set_gpu(void *dt);
         goto err;                                                                                  \
     } while (0)
 
+/*
+ * Deferred property writes. Every fdt_setprop() that adds or grows a property shifts the rest of
+ * the blob, which adds up for the passes that copy large tables and calibration blobs into nodes
+ * all over the tree. Those passes queue their properties here instead, and dt_apply_patches()
+ * merges all of them into the blob with a single copy. Nodes are referred to by path, since
+ * offsets move while the other passes edit the tree. Queued properties are write-only: they are
+ * not visible to fdt_getprop() until applied.
+ */
+#define MAX_DT_PATCHES 128
+
+#define DT_TAGALIGN(x) ALIGN_UP(x, FDT_TAGSIZE)
+
+struct dt_patch {
+    char path[128];
+    char name[64];
+    void *val;
+    int len;
+    /* filled in by dt_apply_patches() */
+    int offset;
+    int oldlen;
+    int nameoff;
+};
+
+static struct dt_patch dt_patches[MAX_DT_PATCHES];
+static int dt_patch_cnt = 0;
+
+static void dt_reset_patches(void)
+{
+    for (int i = 0; i < dt_patch_cnt; i++)
+        free(dt_patches[i].val);
+    dt_patch_cnt = 0;
+}
+
+static struct dt_patch *dt_find_patch(const char *path, const char *name)
+{
+    for (int i = 0; i < dt_patch_cnt; i++)
+        if (!strcmp(dt_patches[i].path, path) && !strcmp(dt_patches[i].name, name))
+            return &dt_patches[i];
+    return NULL;
+}
+
+/* Like fdt_setprop_placeholder(), but *prop points into the queued copy */
+static int dt_setprop_deferred_placeholder(int node, const char *name, int len, void **prop)
+{
+    char path[sizeof(dt_patches[0].path)];
+
+    // Fall back to writing the property right away if it does not fit in the queue
+    if (dt_patch_cnt == MAX_DT_PATCHES || strlen(name) >= sizeof(dt_patches[0].name) ||
+        fdt_get_path(dt, node, path, sizeof(path)) < 0)
+        return fdt_setprop_placeholder(dt, node, name, len, prop);
+
+    void *val = malloc(len ? len : 1);
+    if (!val)
+        return -FDT_ERR_NOSPACE;
+
+    struct dt_patch *patch = dt_find_patch(path, name);
+    if (patch) {
+        free(patch->val);
+    } else {
+        patch = &dt_patches[dt_patch_cnt++];
+        strcpy(patch->path, path);
+        strcpy(patch->name, name);
+    }
+
+    patch->val = val;
+    patch->len = len;
+    *prop = val;
+    return 0;
+}
+
+static int dt_setprop_deferred(int node, const char *name, const void *val, int len)
+{
+    void *prop;
+    int ret = dt_setprop_deferred_placeholder(node, name, len, &prop);
+
+    if (ret < 0)
+        return ret;
+
+    memcpy(prop, val, len);
+    return 0;
+}
+
+/* Drops a queued property along with any copy already in the blob */
+static void dt_delprop_deferred(int node, const char *name)
+{
+    char path[sizeof(dt_patches[0].path)];
+
+    if (fdt_get_path(dt, node, path, sizeof(path)) >= 0) {
+        struct dt_patch *patch = dt_find_patch(path, name);
+        if (patch) {
+            free(patch->val);
+            *patch = dt_patches[--dt_patch_cnt];
+        }
+    }
+
+    fdt_delprop(dt, node, name);
+}
+
+static int dt_find_string(const char *strtab, int size, const char *s)
+{
+    for (int off = 0; off < size; off += strlen(strtab + off) + 1)
+        if (!strcmp(strtab + off, s))
+            return off;
+    return -1;
+}
+
+static int dt_apply_patches(void)
+{
+    int struct_off = fdt_off_dt_struct(dt);
+    int struct_size = fdt_size_dt_struct(dt);
+    int strings_size = fdt_size_dt_strings(dt);
+    const char *strtab = (const char *)dt + fdt_off_dt_strings(dt);
+    int new_struct_size = struct_size;
+    int new_strings_size = strings_size;
+    int cnt = 0;
+
+    // Find where each property goes, and which name in the strings block it uses
+    for (int i = 0; i < dt_patch_cnt; i++) {
+        struct dt_patch *patch = &dt_patches[i];
+        int node = fdt_path_offset(dt, patch->path);
+        if (node < 0) {
+            printf("FDT: %s went away, dropping %s\n", patch->path, patch->name);
+            free(patch->val);
+            continue;
+        }
+
+        int oldlen;
+        const struct fdt_property *prop = fdt_get_property(dt, node, patch->name, &oldlen);
+        if (prop) {
+            // Replace the existing property
+            patch->offset = (const char *)prop - ((const char *)dt + struct_off);
+            patch->oldlen = sizeof(*prop) + DT_TAGALIGN(oldlen);
+            patch->nameoff = fdt32_ld(&prop->nameoff);
+        } else {
+            // New properties go right after the node name, like fdt_setprop() puts them
+            fdt_next_tag(dt, node, &patch->offset);
+            patch->oldlen = 0;
+            patch->nameoff = dt_find_string(strtab, strings_size, patch->name);
+            for (int j = 0; j < cnt && patch->nameoff < 0; j++)
+                if (dt_patches[j].nameoff >= strings_size &&
+                    !strcmp(dt_patches[j].name, patch->name))
+                    patch->nameoff = dt_patches[j].nameoff;
+            if (patch->nameoff < 0) {
+                patch->nameoff = new_strings_size;
+                new_strings_size += strlen(patch->name) + 1;
+            }
+        }
+
+        new_struct_size += sizeof(*prop) + DT_TAGALIGN(patch->len) - patch->oldlen;
+
+        // Keep the list sorted by offset for the merge below. New properties go before a
+        // replaced one at the same offset, which is the first property of the same node.
+        struct dt_patch tmp = *patch;
+        int j = cnt++;
+        for (; j > 0; j--) {
+            struct dt_patch *prev = &dt_patches[j - 1];
+            if (prev->offset < tmp.offset || (prev->offset == tmp.offset && !prev->oldlen) ||
+                (prev->offset == tmp.offset && tmp.oldlen))
+                break;
+            dt_patches[j] = *prev;
+        }
+        dt_patches[j] = tmp;
+    }
+
+    dt_patch_cnt = cnt;
+
+    if (!cnt)
+        return 0;
+
+    if (struct_off + new_struct_size + new_strings_size > (int)fdt_totalsize(dt))
+        bail("FDT: no space to apply %d deferred properties\n", cnt);
+
+    u8 *buf = malloc(new_struct_size + new_strings_size);
+    if (!buf)
+        bail("FDT: out of memory applying deferred properties\n");
+
+    const u8 *src = (const u8 *)dt + struct_off;
+    u8 *p = buf;
+    int pos = 0;
+
+    for (int i = 0; i < cnt; i++) {
+        struct dt_patch *patch = &dt_patches[i];
+        struct fdt_property prop;
+
+        memcpy(p, src + pos, patch->offset - pos);
+        p += patch->offset - pos;
+        pos = patch->offset + patch->oldlen;
+
+        prop.tag = cpu_to_fdt32(FDT_PROP);
+        prop.len = cpu_to_fdt32(patch->len);
+        prop.nameoff = cpu_to_fdt32(patch->nameoff);
+        memcpy(p, &prop, sizeof(prop));
+        p += sizeof(prop);
+        memcpy(p, patch->val, patch->len);
+        memset(p + patch->len, 0, DT_TAGALIGN(patch->len) - patch->len);
+        p += DT_TAGALIGN(patch->len);
+    }
+    memcpy(p, src + pos, struct_size - pos);
+    p += struct_size - pos;
+
+    memcpy(p, strtab, strings_size);
+    for (int i = 0; i < cnt; i++)
+        if (dt_patches[i].nameoff >= strings_size)
+            strcpy((char *)p + dt_patches[i].nameoff, dt_patches[i].name);
+
+    memcpy((u8 *)dt + struct_off, buf, new_struct_size + new_strings_size);
+    free(buf);
+
+    fdt_set_size_dt_struct(dt, new_struct_size);
+    fdt_set_off_dt_strings(dt, struct_off + new_struct_size);
+    fdt_set_size_dt_strings(dt, new_strings_size);
+
+    // The merge is one more copy of the blob, count it like libfdt counts its moves
+    fdt_splice_bytes += new_struct_size + new_strings_size;
+
+    dt_reset_patches();
+    return 0;
+}
+
 void get_notchless_fb(u64 *fb_base, u64 *fb_height)
 {
     *fb_base = cur_boot_args.video.base;
@@ -601,7 +821,7 @@ static int dt_set_mac_addresses(void)
         if (node < 0)
             continue;
 
-        fdt_setprop(dt, node, mac_address_devices[i].fdt_property, addr, sizeof(addr));
+        dt_setprop_deferred(node, mac_address_devices[i].fdt_property, addr, sizeof(addr));
     }
 
     return 0;
@@ -615,7 +835,7 @@ static int dt_set_bluetooth_cal(int anode, int node, const char *adt_name, const
     if (!cal_blob || !len)
         bail("ADT: Failed to get %s\n", adt_name);
 
-    fdt_setprop(dt, node, fdt_name, cal_blob, len);
+    dt_setprop_deferred(node, fdt_name, cal_blob, len);
     return 0;
 }
 
@@ -678,7 +898,7 @@ static int dt_set_multitouch(void)
         return 0;
     }
 
-    fdt_setprop(dt, node, "apple,z2-cal-blob", cal_blob, len);
+    dt_setprop_deferred(node, "apple,z2-cal-blob", cal_blob, len);
     return 0;
 }
 
@@ -750,7 +970,7 @@ static int dt_set_wifi(void)
 
     char antenna[8];
     memcpy(antenna, &info[8], sizeof(antenna));
-    fdt_setprop_string(dt, node, "apple,antenna-sku", antenna);
+    dt_setprop_deferred(node, "apple,antenna-sku", antenna, strlen(antenna) + 1);
 
     u32 len;
     const u8 *cal_blob = adt_getprop(adt, anode, "wifi-calibration-msf", &len);
@@ -758,7 +978,7 @@ static int dt_set_wifi(void)
     if (!cal_blob || !len)
         bail("ADT: Failed to get wifi-calibration-msf\n");
 
-    fdt_setprop(dt, node, "brcm,cal-blob", cal_blob, len);
+    dt_setprop_deferred(node, "brcm,cal-blob", cal_blob, len);
 
     return 0;
 }
@@ -871,15 +1091,23 @@ static const struct adt_tunable_info atc_tunables[] = {
     {"tunable_CIO_LN1_AUSPMA_TX_TOP", "apple,tunable-lane1-cio", 0x13000, 0x1000, true},
 };
 
-static int dt_append_atc_tunable(int adt_node, int fdt_node,
-                                 const struct adt_tunable_info *tunable_info)
+/*
+ * Tunable converters validate one ADT tunable and return the number of FDT cells
+ * it expands to. If out is non-NULL, the cells are also written there.
+ */
+typedef int (*dt_tunable_conv_t)(int adt_node, const struct adt_tunable_info *tunable_info,
+                                 fdt32_t *out);
+
+static int dt_convert_atc_tunable(int adt_node, const struct adt_tunable_info *tunable_info,
+                                  fdt32_t *out)
 {
     u32 tunables_len;
     const struct atc_tunable *tunable_adt =
         adt_getprop(adt, adt_node, tunable_info->adt_name, &tunables_len);
 
     if (!tunable_adt) {
-        printf("ADT: tunable %s not found\n", tunable_info->adt_name);
+        if (!out)
+            printf("ADT: tunable %s not found\n", tunable_info->adt_name);
 
         if (tunable_info->required)
             return -1;
@@ -896,6 +1124,13 @@ static int dt_append_atc_tunable(int adt_node, int fdt_node,
     for (size_t j = 0; j < n_tunables; j++) {
         const struct atc_tunable *tunable = &tunable_adt[j];
 
+        if (out) {
+            fdt32_st(out++, tunable->offset + tunable_info->reg_offset);
+            fdt32_st(out++, tunable->mask);
+            fdt32_st(out++, tunable->value);
+            continue;
+        }
+
         if (tunable->size != 32) {
             printf("kboot: ATC tunable has invalid size %d\n", tunable->size);
             return -1;
@@ -910,14 +1145,57 @@ static int dt_append_atc_tunable(int adt_node, int fdt_node,
             printf("kboot: ATC tunable has invalid offset %x\n", tunable->offset);
             return -1;
         }
+    }
 
-        if (fdt_appendprop_u32(dt, fdt_node, tunable_info->fdt_name,
-                               tunable->offset + tunable_info->reg_offset) < 0)
-            return -1;
-        if (fdt_appendprop_u32(dt, fdt_node, tunable_info->fdt_name, tunable->mask) < 0)
-            return -1;
-        if (fdt_appendprop_u32(dt, fdt_node, tunable_info->fdt_name, tunable->value) < 0)
-            return -1;
+    return n_tunables * 3;
+}
+
+/*
+ * Several ADT tunables can map to the same FDT property. Instead of appending
+ * them one cell at a time, size every property up front and fill in a single
+ * deferred placeholder, which lands in the blob with dt_apply_patches().
+ */
+static int dt_copy_tunables(int adt_node, int fdt_node, const struct adt_tunable_info *tunables,
+                            size_t count, dt_tunable_conv_t conv)
+{
+    for (size_t i = 0; i < count; i++) {
+        const char *fdt_name = tunables[i].fdt_name;
+        bool done = false;
+
+        for (size_t j = 0; j < i; j++) {
+            if (!strcmp(tunables[j].fdt_name, fdt_name)) {
+                done = true;
+                break;
+            }
+        }
+
+        if (done)
+            continue;
+
+        size_t cells = 0;
+        for (size_t j = i; j < count; j++) {
+            if (strcmp(tunables[j].fdt_name, fdt_name))
+                continue;
+
+            int ret = conv(adt_node, &tunables[j], NULL);
+            if (ret < 0)
+                bail("ADT: unable to convert '%s' tunable\n", tunables[j].adt_name);
+
+            cells += ret;
+        }
+
+        if (!cells)
+            continue;
+
+        void *prop;
+        if (dt_setprop_deferred_placeholder(fdt_node, fdt_name, cells * sizeof(fdt32_t), &prop) < 0)
+            bail("FDT: couldn't allocate '%s' property\n", fdt_name);
+
+        fdt32_t *out = prop;
+        for (size_t j = i; j < count; j++) {
+            if (!strcmp(tunables[j].fdt_name, fdt_name))
+                out += conv(adt_node, &tunables[j], out);
+        }
     }
 
     return 0;
@@ -925,8 +1203,6 @@ static int dt_append_atc_tunable(int adt_node, int fdt_node,
 
 static void dt_copy_atc_tunables(const char *adt_path, const char *dt_alias)
 {
-    int ret;
-
     int adt_node = adt_path_offset(adt, adt_path);
     if (adt_node < 0)
         return;
@@ -943,22 +1219,17 @@ static void dt_copy_atc_tunables(const char *adt_path, const char *dt_alias)
         return;
     }
 
-    for (size_t i = 0; i < sizeof(atc_tunables) / sizeof(*atc_tunables); ++i) {
-        ret = dt_append_atc_tunable(adt_node, fdt_node, &atc_tunables[i]);
-        if (ret)
-            goto cleanup;
-    }
-
-    return;
+    if (!dt_copy_tunables(adt_node, fdt_node, atc_tunables, ARRAY_SIZE(atc_tunables),
+                          dt_convert_atc_tunable))
+        return;
 
-cleanup:
     /*
      * USB3 and Thunderbolt won't work if something went wrong. Clean up to make
      * sure we don't leave half-filled properties around so that we can at least
      * try to boot with USB2 support only.
      */
     for (size_t i = 0; i < sizeof(atc_tunables) / sizeof(*atc_tunables); ++i)
-        fdt_delprop(dt, fdt_node, atc_tunables[i].fdt_name);
+        dt_delprop_deferred(fdt_node, atc_tunables[i].fdt_name);
 
     printf("FDT: Unable to setup ATC tunables for %s - USB3/Thunderbolt will not work\n", adt_path);
 }
@@ -1007,19 +1278,20 @@ struct acio_tunable {
 static_assert(sizeof(struct acio_tunable) == 24, "Invalid acio_tunable size");
 
 /*
- * This is *almost* identical to dt_append_atc_tunable except for the different
+ * This is *almost* identical to dt_convert_atc_tunable except for the different
  * tunable struct and that tunable->size is in bytes instead of bits.
  * If only C had generics that aren't macros :-(
  */
-static int dt_append_acio_tunable(int adt_node, int fdt_node,
-                                  const struct adt_tunable_info *tunable_info)
+static int dt_convert_acio_tunable(int adt_node, const struct adt_tunable_info *tunable_info,
+                                   fdt32_t *out)
 {
     u32 tunables_len;
     const struct acio_tunable *tunable_adt =
         adt_getprop(adt, adt_node, tunable_info->adt_name, &tunables_len);
 
     if (!tunable_adt) {
-        printf("ADT: tunable %s not found\n", tunable_info->adt_name);
+        if (!out)
+            printf("ADT: tunable %s not found\n", tunable_info->adt_name);
 
         if (tunable_info->required)
             return -1;
@@ -1036,6 +1308,13 @@ static int dt_append_acio_tunable(int adt_node, int fdt_node,
     for (size_t j = 0; j < n_tunables; j++) {
         const struct acio_tunable *tunable = &tunable_adt[j];
 
+        if (out) {
+            fdt32_st(out++, tunable->offset + tunable_info->reg_offset);
+            fdt32_st(out++, tunable->mask);
+            fdt32_st(out++, tunable->value);
+            continue;
+        }
+
         if (tunable->size != 4) {
             printf("kboot: ACIO tunable has invalid size %d\n", tunable->size);
             return -1;
@@ -1050,17 +1329,9 @@ static int dt_append_acio_tunable(int adt_node, int fdt_node,
             printf("kboot: ACIO tunable has invalid offset %x\n", tunable->offset);
             return -1;
         }
-
-        if (fdt_appendprop_u32(dt, fdt_node, tunable_info->fdt_name,
-                               tunable->offset + tunable_info->reg_offset) < 0)
-            return -1;
-        if (fdt_appendprop_u32(dt, fdt_node, tunable_info->fdt_name, tunable->mask) < 0)
-            return -1;
-        if (fdt_appendprop_u32(dt, fdt_node, tunable_info->fdt_name, tunable->value) < 0)
-            return -1;
     }
 
-    return 0;
+    return n_tunables * 3;
 }
 
 static int dt_copy_acio_tunables(const char *adt_path, const char *dt_alias)
@@ -1083,20 +1354,19 @@ static int dt_copy_acio_tunables(const char *adt_path, const char *dt_alias)
     if (!drom_blob || !drom_len)
         bail("ADT: Failed to get thunderbolt-drom\n");
 
-    fdt_setprop(dt, fdt_node, "apple,thunderbolt-drom", drom_blob, drom_len);
-    for (size_t i = 0; i < sizeof(acio_tunables) / sizeof(*acio_tunables); ++i) {
-        ret = dt_append_acio_tunable(adt_node, fdt_node, &acio_tunables[i]);
-        if (ret)
-            bail_cleanup("ADT: unable to convert '%s' tunable\n", acio_tunables[i].adt_name);
-    }
+    dt_setprop_deferred(fdt_node, "apple,thunderbolt-drom", drom_blob, drom_len);
+    ret = dt_copy_tunables(adt_node, fdt_node, acio_tunables, ARRAY_SIZE(acio_tunables),
+                           dt_convert_acio_tunable);
+    if (ret)
+        goto err;
 
     return 0;
 
 err:
-    fdt_delprop(dt, fdt_node, "apple,thunderbolt-drom");
-    fdt_delprop(dt, fdt_node, "apple,tunable-nhi");
-    fdt_delprop(dt, fdt_node, "apple,tunable-m3");
-    fdt_delprop(dt, fdt_node, "apple,tunable-pcie-adapter");
+    dt_delprop_deferred(fdt_node, "apple,thunderbolt-drom");
+    dt_delprop_deferred(fdt_node, "apple,tunable-nhi");
+    dt_delprop_deferred(fdt_node, "apple,tunable-m3");
+    dt_delprop_deferred(fdt_node, "apple,tunable-pcie-adapter");
 
     return -1;
 }
@@ -1176,17 +1446,15 @@ static int dt_device_set_reserved_mem(int node, const char *name, uint32_t phand
 {
     int ret;
 
-    ret = fdt_appendprop_u32(dt, node, "iommu-addresses", phandle);
-    if (ret != 0)
-        bail("FDT: could not append phandle to '%s.iommu-addresses' property: %d\n", name, ret);
+    fdt32_t prop[5];
 
-    ret = fdt_appendprop_u64(dt, node, "iommu-addresses", iova);
-    if (ret != 0)
-        bail("FDT: could not append iova to '%s.iommu-addresses' property: %d\n", name, ret);
+    fdt32_st(&prop[0], phandle);
+    fdt64_st(&prop[1], iova);
+    fdt64_st(&prop[3], size);
 
-    ret = fdt_appendprop_u64(dt, node, "iommu-addresses", size);
+    ret = fdt_appendprop(dt, node, "iommu-addresses", prop, sizeof(prop));
     if (ret != 0)
-        bail("FDT: could not append size to '%s.iommu-addresses' property: %d\n", name, ret);
+        bail("FDT: could not append to '%s.iommu-addresses' property: %d\n", name, ret);
 
     return 0;
 }
@@ -2050,12 +2318,77 @@ int kboot_set_chosen(const char *name, const char *value)
     return i;
 }
 
+static int dt_disable_missing_usb(void)
+{
+    return dt_disable_missing_devs("usb-drd", "usb@", 8);
+}
+
+static int dt_disable_missing_i2c(void)
+{
+    return dt_disable_missing_devs("i2c", "i2c@", 8);
+}
+
+static int dt_reserve_sio_firmware(void)
+{
+    return dt_reserve_asc_firmware("/arm-io/sio", "sio");
+}
+
+static int dt_set_gpu_pass(void)
+{
+    return dt_set_gpu(dt);
+}
+
+struct dt_pass {
+    const char *name;
+    int (*fn)(void);
+};
+
+#define DT_PASS(f) {#f, f}
+
+/*
+ * Devicetree preparation passes, run in order. dt_apply_patches() writes out the
+ * properties queued by the passes before it. The /memory node goes last since
+ * the other passes might allocate from the top of memory, and we want an
+ * up-to-date value for the usable memory span to make it into the devicetree.
+ */
+static const struct dt_pass dt_passes[] = {
+    DT_PASS(dt_set_chosen),
+    DT_PASS(dt_set_serial_number),
+    DT_PASS(dt_set_cpus),
+    DT_PASS(dt_set_mac_addresses),
+    DT_PASS(dt_set_wifi),
+    DT_PASS(dt_set_bluetooth),
+    DT_PASS(dt_set_uboot),
+    DT_PASS(dt_set_atc_tunables),
+    DT_PASS(dt_set_acio_tunables),
+    DT_PASS(dt_set_display),
+    DT_PASS(dt_set_gpu_pass),
+    DT_PASS(dt_set_multitouch),
+    DT_PASS(dt_set_ipd),
+    DT_PASS(dt_disable_missing_usb),
+    DT_PASS(dt_disable_missing_i2c),
+    DT_PASS(dt_reserve_sio_firmware),
+    DT_PASS(dt_set_sio_fwdata),
+#ifndef RELEASE
+    DT_PASS(dt_transfer_virtios),
+#endif
+    DT_PASS(dt_apply_patches),
+    DT_PASS(dt_set_memory),
+    {},
+};
+
+void kboot_set_verbose(bool verbose)
+{
+    dt_verbose = verbose;
+}
+
 int kboot_prepare_dt(void *fdt)
 {
     if (dt) {
         free(dt);
         dt = NULL;
     }
+    dt_reset_patches();
 
     dt_bufsize = fdt_totalsize(fdt);
     assert(dt_bufsize);
@@ -2072,57 +2405,29 @@ int kboot_prepare_dt(void *fdt)
     if (fdt_add_mem_rsv(dt, (u64)_base, ((u64)_end) - ((u64)_base)))
         bail("FDT: couldn't add reservation for m1n1\n");
 
-    if (dt_set_chosen())
-        return -1;
-    if (dt_set_serial_number())
-        return -1;
-    if (dt_set_cpus())
-        return -1;
-    if (dt_set_mac_addresses())
-        return -1;
-    if (dt_set_wifi())
-        return -1;
-    if (dt_set_bluetooth())
-        return -1;
-    if (dt_set_uboot())
-        return -1;
-    if (dt_set_atc_tunables())
-        return -1;
-    if (dt_set_acio_tunables())
-        return -1;
-    if (dt_set_display())
-        return -1;
-    if (dt_set_gpu(dt))
-        return -1;
-    if (dt_set_multitouch())
-        return -1;
-    if (dt_set_ipd())
-        return -1;
-    if (dt_disable_missing_devs("usb-drd", "usb@", 8))
-        return -1;
-    if (dt_disable_missing_devs("i2c", "i2c@", 8))
-        return -1;
-    if (dt_reserve_asc_firmware("/arm-io/sio", "sio"))
-        return -1;
-    if (dt_set_sio_fwdata())
-        return -1;
-#ifndef RELEASE
-    if (dt_transfer_virtios())
-        return 1;
-#endif
+    u64 start = get_ticks();
+    u64 moved_start = fdt_splice_bytes;
+    u64 splice_bytes = fdt_splice_bytes;
 
-    /*
-     * Set the /memory node late since we might be allocating from the top of memory
-     * in one of the above devicetree prep functions, and we want an up-to-date value
-     * for the usable memory span to make it into the devicetree.
-     */
-    if (dt_set_memory())
-        return -1;
+    for (const struct dt_pass *pass = dt_passes; pass->name; pass++) {
+        u64 pass_start = get_ticks();
+
+        if (pass->fn()) {
+            printf("FDT: %s failed\n", pass->name);
+            return -1;
+        }
+
+        if (dt_verbose)
+            printf("FDT: %s took %ld us, moved %ld bytes\n", pass->name,
+                   ticks_to_usecs(get_ticks() - pass_start), fdt_splice_bytes - splice_bytes);
+        splice_bytes = fdt_splice_bytes;
+    }
 
     if (fdt_pack(dt))
         bail("FDT: fdt_pack() failed\n");
 
-    printf("FDT prepared at %p\n", dt);
+    printf("FDT prepared at %p in %ld us (%ld bytes moved by libfdt)\n", dt,
+           ticks_to_usecs(get_ticks() - start), fdt_splice_bytes - moved_start);
 
     return 0;
 }
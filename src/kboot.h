@@ -20,6 +20,7 @@ struct kernel_header {
 void kboot_set_initrd(void *start, size_t size);
 int kboot_set_chosen(const char *name, const char *value);
 int kboot_prepare_dt(void *fdt);
+void kboot_set_verbose(bool verbose);
 int kboot_boot(void *kernel);
 
 #endif
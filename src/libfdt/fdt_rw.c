@@ -51,6 +51,9 @@ static inline unsigned int fdt_data_size_(void *fdt)
 	return fdt_off_dt_strings(fdt) + fdt_size_dt_strings(fdt);
 }
 
+/* m1n1: total number of bytes shifted by fdt_splice_(), for instrumentation */
+unsigned long fdt_splice_bytes;
+
 static int fdt_splice_(void *fdt, void *splicepoint, int oldlen, int newlen)
 {
 	char *p = splicepoint;
@@ -64,6 +67,7 @@ static int fdt_splice_(void *fdt, void *splicepoint, int oldlen, int newlen)
 	if (dsize - oldlen + newlen > fdt_totalsize(fdt))
 		return -FDT_ERR_NOSPACE;
 	memmove(p + newlen, p + oldlen, ((char *)fdt + dsize) - (p + oldlen));
+	fdt_splice_bytes += ((char *)fdt + dsize) - (p + oldlen);
 	return 0;
 }
 
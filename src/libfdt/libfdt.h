@@ -1479,6 +1479,9 @@ int fdt_finish(void *fdt);
 /* Read-write functions                                               */
 /**********************************************************************/
 
+/* m1n1: total number of bytes shifted by read-write operations */
+extern unsigned long fdt_splice_bytes;
+
 int fdt_create_empty_tree(void *buf, int bufsize);
 int fdt_open_into(const void *fdt, void *buf, int bufsize);
 int fdt_pack(void *fdt);
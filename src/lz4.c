@@ -0,0 +1,462 @@
+/* SPDX-License-Identifier: MIT */
+
+#include "lz4.h"
+#include "smp.h"
+#include "string.h"
+#include "utils.h"
+
+#define LZ4_FLG_VERSION   GENMASK(7, 6)
+#define LZ4_FLG_B_INDEP   BIT(5)
+#define LZ4_FLG_B_CSUM    BIT(4)
+#define LZ4_FLG_C_SIZE    BIT(3)
+#define LZ4_FLG_C_CSUM    BIT(2)
+#define LZ4_FLG_RESERVED  BIT(1)
+#define LZ4_FLG_DICT_ID   BIT(0)
+#define LZ4_BD_BLOCK_MAX  GENMASK(6, 4)
+#define LZ4_BD_RESERVED   (BIT(7) | GENMASK(3, 0))
+#define LZ4_BLOCK_RAW     BIT(31)
+#define LZ4_BLOCK_SIZE    GENMASK(30, 0)
+#define LZ4_MIN_MATCH     4
+
+/*
+ * Legacy (lz4 -l) blocks all decode to 8MiB except for the last one of a stream, and are never
+ * larger than the worst-case compressed size of that.
+ */
+#define LZ4_LEGACY_BLOCK (8 * SZ_1M)
+#define LZ4_LEGACY_BOUND (LZ4_LEGACY_BLOCK + LZ4_LEGACY_BLOCK / 255 + 16)
+
+/*
+ * Independent blocks are indexed in batches and decoded in parallel, each into its own
+ * block-max-sized slot, then compacted. Every block but the last of a frame is normally full, so
+ * the compaction is usually a no-op.
+ */
+#define LZ4_BATCH 256
+
+#define XXH_PRIME1 2654435761U
+#define XXH_PRIME2 2246822519U
+#define XXH_PRIME3 3266489917U
+#define XXH_PRIME4 668265263U
+#define XXH_PRIME5 374761393U
+
+struct lz4_block {
+    const u8 *src;
+    u32 csize;
+    bool raw;
+    u8 *dst;
+    size_t cap;
+    size_t out;
+    bool failed;
+};
+
+struct lz4_job {
+    struct lz4_block *blocks;
+    const u8 *base;
+    bool block_csum;
+};
+
+static struct lz4_block lz4_blocks[LZ4_BATCH];
+
+static inline u32 get_le32(const u8 *p)
+{
+    u32 v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline u32 rotl32(u32 x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline u32 xxh32_round(u32 acc, u32 input)
+{
+    return rotl32(acc + input * XXH_PRIME2, 13) * XXH_PRIME1;
+}
+
+static u32 xxh32(const u8 *p, size_t len, u32 seed)
+{
+    const u8 *end = p + len;
+    u32 h;
+
+    if (len >= 16) {
+        u32 v1 = seed + XXH_PRIME1 + XXH_PRIME2;
+        u32 v2 = seed + XXH_PRIME2;
+        u32 v3 = seed;
+        u32 v4 = seed - XXH_PRIME1;
+
+        do {
+            v1 = xxh32_round(v1, get_le32(p));
+            v2 = xxh32_round(v2, get_le32(p + 4));
+            v3 = xxh32_round(v3, get_le32(p + 8));
+            v4 = xxh32_round(v4, get_le32(p + 12));
+            p += 16;
+        } while (end - p >= 16);
+
+        h = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18);
+    } else {
+        h = seed + XXH_PRIME5;
+    }
+
+    h += len;
+
+    for (; end - p >= 4; p += 4)
+        h = rotl32(h + get_le32(p) * XXH_PRIME3, 17) * XXH_PRIME4;
+    for (; p < end; p++)
+        h = rotl32(h + *p * XXH_PRIME5, 11) * XXH_PRIME1;
+
+    h ^= h >> 15;
+    h *= XXH_PRIME2;
+    h ^= h >> 13;
+    h *= XXH_PRIME3;
+    h ^= h >> 16;
+
+    return h;
+}
+
+static int lz4_read_length(const u8 **ip, const u8 *iend, size_t *len)
+{
+    u8 b;
+
+    do {
+        if (*ip >= iend)
+            return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+
+    return 0;
+}
+
+/*
+ * Decode one block into dst. Matches may reach back as far as base, which is dst itself for
+ * independent blocks and the start of the frame output for linked blocks.
+ */
+static int lz4_decode_block(u8 *dst, size_t cap, const u8 *base, const u8 *src, size_t len,
+                            size_t *out)
+{
+    const u8 *ip = src, *iend = src + len;
+    u8 *op = dst, *oend = dst + cap;
+
+    while (ip < iend) {
+        u8 token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15 && lz4_read_length(&ip, iend, &lit))
+            return -1;
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+            return -1;
+
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+
+        // The last sequence only has literals
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!offset || offset > (size_t)(op - base))
+            return -1;
+
+        size_t ml = token & 15;
+        if (ml == 15 && lz4_read_length(&ip, iend, &ml))
+            return -1;
+        ml += LZ4_MIN_MATCH;
+        if (ml > (size_t)(oend - op))
+            return -1;
+
+        const u8 *match = op - offset;
+        if (offset >= ml) {
+            memcpy(op, match, ml);
+            op += ml;
+        } else {
+            while (ml--)
+                *op++ = *match++;
+        }
+    }
+
+    *out = op - dst;
+    return 0;
+}
+
+static void lz4_decode_blocks(void *arg, u64 start, u64 end)
+{
+    struct lz4_job *job = arg;
+
+    for (u64 i = start; i < end; i++) {
+        struct lz4_block *b = &job->blocks[i];
+
+        if (job->block_csum && xxh32(b->src, b->csize, 0) != get_le32(b->src + b->csize)) {
+            b->failed = true;
+            continue;
+        }
+
+        if (b->raw) {
+            if (b->csize > b->cap) {
+                b->failed = true;
+                continue;
+            }
+            memcpy(b->dst, b->src, b->csize);
+            b->out = b->csize;
+        } else if (lz4_decode_block(b->dst, b->cap, job->base ? job->base : b->dst, b->src,
+                                    b->csize, &b->out)) {
+            b->failed = true;
+        }
+    }
+}
+
+/* Decode a batch of independent blocks in parallel, each into its own block_max-sized slot. */
+static void lz4_decode_batch(struct lz4_job *job, size_t count, size_t block_max, u8 *out,
+                             u8 *out_end)
+{
+    for (size_t i = 0; i < count; i++) {
+        u8 *slot = out + i * block_max;
+        job->blocks[i].dst = slot;
+        job->blocks[i].cap = slot < out_end ? min(block_max, (size_t)(out_end - slot)) : 0;
+    }
+
+    smp_parallel_for(0, count, 1, lz4_decode_blocks, job);
+}
+
+static int lz4_decompress_frame(void *dest, size_t *dest_len, const void *src, size_t *src_len)
+{
+    const u8 *p = src;
+    // Payloads of unknown length are bounded by the 32-bit size fields of other formats anyway
+    const u8 *src_end = p + (*src_len ? *src_len : UINT32_MAX);
+    u8 *out = dest;
+    u8 *out_end = out + *dest_len;
+
+    if (src_end - p < 7)
+        return -1;
+
+    u8 flg = p[4], bd = p[5];
+    if (FIELD_GET(LZ4_FLG_VERSION, flg) != 1 || (flg & (LZ4_FLG_RESERVED | LZ4_FLG_DICT_ID)) ||
+        (bd & LZ4_BD_RESERVED) || FIELD_GET(LZ4_BD_BLOCK_MAX, bd) < 4)
+        return -1;
+
+    // 4: 64KiB, 5: 256KiB, 6: 1MiB, 7: 4MiB
+    size_t block_max = 1UL << (8 + 2 * FIELD_GET(LZ4_BD_BLOCK_MAX, bd));
+
+    const u8 *desc = p + 4;
+    size_t desc_len = 2 + ((flg & LZ4_FLG_C_SIZE) ? 8 : 0);
+    if ((size_t)(src_end - desc) < desc_len + 1)
+        return -1;
+    if (((xxh32(desc, desc_len, 0) >> 8) & 0xff) != desc[desc_len])
+        return -1;
+    p = desc + desc_len + 1;
+
+    struct lz4_job job = {
+        .blocks = lz4_blocks,
+        .base = (flg & LZ4_FLG_B_INDEP) ? NULL : dest,
+        .block_csum = flg & LZ4_FLG_B_CSUM,
+    };
+    size_t csum_len = job.block_csum ? 4 : 0;
+    bool done = false;
+
+    while (!done) {
+        size_t count = 0;
+
+        while (count < LZ4_BATCH) {
+            if (src_end - p < 4)
+                return -1;
+
+            u32 bsize = get_le32(p);
+            p += 4;
+            if (!bsize) {
+                done = true;
+                break;
+            }
+
+            struct lz4_block *b = &lz4_blocks[count++];
+            b->src = p;
+            b->csize = FIELD_GET(LZ4_BLOCK_SIZE, bsize);
+            b->raw = bsize & LZ4_BLOCK_RAW;
+            b->out = 0;
+            b->failed = false;
+
+            if (b->csize > block_max || (size_t)(src_end - p) < b->csize + csum_len)
+                return -1;
+            p += b->csize + csum_len;
+        }
+
+        if (job.base) {
+            // Linked blocks reference earlier output, so decode them in order
+            for (size_t i = 0; i < count; i++) {
+                lz4_blocks[i].dst = out;
+                lz4_blocks[i].cap = out_end - out;
+                lz4_decode_blocks(&job, i, i + 1);
+                if (lz4_blocks[i].failed)
+                    return -1;
+                out += lz4_blocks[i].out;
+            }
+            continue;
+        }
+
+        lz4_decode_batch(&job, count, block_max, out, out_end);
+
+        for (size_t i = 0; i < count; i++) {
+            if (lz4_blocks[i].failed)
+                return -1;
+            if (lz4_blocks[i].dst != out)
+                memmove(out, lz4_blocks[i].dst, lz4_blocks[i].out);
+            out += lz4_blocks[i].out;
+        }
+    }
+
+    size_t total = out - (u8 *)dest;
+
+    if (flg & LZ4_FLG_C_SIZE) {
+        u64 content_size;
+        memcpy(&content_size, desc + 2, 8);
+        if (content_size != total)
+            return -1;
+    }
+
+    if (flg & LZ4_FLG_C_CSUM) {
+        if (src_end - p < 4 || xxh32(dest, total, 0) != get_le32(p))
+            return -1;
+        p += 4;
+    }
+
+    *dest_len = total;
+    *src_len = p - (const u8 *)src;
+    return 0;
+}
+
+/*
+ * Walk the sequences of a block to find how much it decodes to, without decoding it. Returns -1 if
+ * the block is malformed.
+ */
+static int lz4_block_out_size(const u8 *src, size_t len, size_t *out)
+{
+    const u8 *ip = src, *iend = src + len;
+    size_t total = 0;
+
+    while (ip < iend) {
+        u8 token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15 && lz4_read_length(&ip, iend, &lit))
+            return -1;
+        if (lit > (size_t)(iend - ip))
+            return -1;
+        ip += lit;
+        total += lit;
+
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        ip += 2;
+
+        size_t ml = token & 15;
+        if (ml == 15 && lz4_read_length(&ip, iend, &ml))
+            return -1;
+        total += ml + LZ4_MIN_MATCH;
+    }
+
+    *out = total;
+    return 0;
+}
+
+/*
+ * The legacy format (lz4 -l, which is what the Linux Image.lz4 and lz4 initramfs targets produce)
+ * has no end marker. A stream ends at the end of the source, at a size word that cannot belong to
+ * a block, or after its first short block, unless another stream follows with its own magic. Block
+ * sizes are found with a quick scan while indexing, so nothing past the end of the stream is read.
+ * Only a stream whose output is an exact multiple of 8MiB cannot be told apart from what follows
+ * it, when the source length is not known.
+ */
+static int lz4_decompress_legacy(void *dest, size_t *dest_len, const void *src, size_t *src_len)
+{
+    const u8 *p = src;
+    const u8 *src_end = p + (*src_len ? *src_len : UINT32_MAX);
+    u8 *out = dest;
+    u8 *out_end = out + *dest_len;
+    bool ended = false; // The current stream had a short block, only a new magic continues
+    bool done = false;
+
+    struct lz4_job job = {
+        .blocks = lz4_blocks,
+        .base = NULL,
+        .block_csum = false,
+    };
+
+    while (!done) {
+        size_t count = 0;
+
+        while (count < LZ4_BATCH) {
+            if (src_end - p < 4) {
+                done = true;
+                break;
+            }
+
+            u32 bsize = get_le32(p);
+            if (bsize == LZ4_LEGACY_MAGIC) {
+                p += 4;
+                ended = false;
+                continue;
+            }
+            if (ended || !bsize || bsize > LZ4_LEGACY_BOUND) {
+                done = true;
+                break;
+            }
+            if ((size_t)(src_end - p - 4) < bsize)
+                return -1;
+            p += 4;
+
+            struct lz4_block *b = &lz4_blocks[count++];
+            b->src = p;
+            b->csize = bsize;
+            b->raw = false;
+            b->out = 0;
+            b->failed = false;
+
+            size_t size;
+            if (lz4_block_out_size(p, bsize, &size) || size > LZ4_LEGACY_BLOCK)
+                return -1;
+            ended = size < LZ4_LEGACY_BLOCK;
+
+            p += bsize;
+        }
+
+        lz4_decode_batch(&job, count, LZ4_LEGACY_BLOCK, out, out_end);
+
+        for (size_t i = 0; i < count; i++) {
+            if (lz4_blocks[i].failed)
+                return -1;
+            if (lz4_blocks[i].dst != out)
+                memmove(out, lz4_blocks[i].dst, lz4_blocks[i].out);
+            out += lz4_blocks[i].out;
+        }
+    }
+
+    size_t total = out - (u8 *)dest;
+
+    // Linux appends the uncompressed size to its lz4 images
+    if (src_end - p >= 4 && get_le32(p) == (u32)total)
+        p += 4;
+
+    *dest_len = total;
+    *src_len = p - (const u8 *)src;
+    return 0;
+}
+
+int lz4_decompress(void *dest, size_t *dest_len, const void *src, size_t *src_len)
+{
+    if (*src_len && *src_len < 4)
+        return -1;
+
+    switch (get_le32(src)) {
+        case LZ4_FRAME_MAGIC:
+            return lz4_decompress_frame(dest, dest_len, src, src_len);
+        case LZ4_LEGACY_MAGIC:
+            return lz4_decompress_legacy(dest, dest_len, src, src_len);
+        default:
+            return -1;
+    }
+}
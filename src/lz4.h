@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef LZ4_H
+#define LZ4_H
+
+#include "types.h"
+
+#define LZ4_FRAME_MAGIC  0x184d2204
+#define LZ4_LEGACY_MAGIC 0x184c2102
+
+/*
+ * Decode a single LZ4 frame, or a legacy format stream (which may consist of several concatenated
+ * streams). On entry, *dest_len and *src_len hold the available space (a source
+ * length of 0 means unknown); on success they are updated with the number of bytes produced and
+ * consumed. Returns 0 on success, -1 on error.
+ */
+int lz4_decompress(void *dest, size_t *dest_len, const void *src, size_t *src_len);
+
+#endif
@@ -34,6 +34,13 @@ CACHE_RANGE_OP(dc_cvac_range, "dc cvac")
 CACHE_RANGE_OP(dc_cvau_range, "dc cvau")
 CACHE_RANGE_OP(dc_civac_range, "dc civac")
 
+/*
+ * Ranges at least this large are zeroed with DC ZVA across all available CPUs. Below that the
+ * dispatch overhead outweighs the gain.
+ */
+#define MEMZERO_MIN_SIZE (4 * SZ_1M)
+#define MEMZERO_GRAIN    SZ_1M
+
 extern u8 _stack_top[];
 
 uint64_t ram_base = 0;
@@ -533,6 +540,42 @@ static void mmu_secondary_setup(void)
     write_sctlr(sctlr);
 }
 
+static void memzero_chunk(void *arg, u64 start, u64 end)
+{
+    UNUSED(arg);
+
+    dc_zva_range((void *)start, end - start);
+}
+
+bool memzero_is_fast(void *addr, size_t size)
+{
+    u64 start = (u64)addr;
+    u64 end = start + size;
+
+    // DC ZVA faults on device memory, so only take the fast path for mapped RAM
+    return size >= MEMZERO_MIN_SIZE && mmu_active() && start >= ram_base && end > start &&
+           end <= ram_base + cur_boot_args.mem_size_actual;
+}
+
+void memzero_parallel(void *addr, size_t size)
+{
+    u64 start = (u64)addr;
+    u64 end = start + size;
+
+    if (!memzero_is_fast(addr, size)) {
+        memset(addr, 0, size);
+        return;
+    }
+
+    u64 zstart = ALIGN_UP(start, CACHE_LINE_SIZE);
+    u64 zend = ALIGN_DOWN(end, CACHE_LINE_SIZE);
+
+    memset(addr, 0, zstart - start);
+    memset((void *)zend, 0, end - zend);
+
+    smp_parallel_for(zstart, zend, MEMZERO_GRAIN, memzero_chunk, NULL);
+}
+
 void mmu_init_secondary(int cpu)
 {
     smp_call4(cpu, mmu_secondary_setup, 0, 0, 0, 0);
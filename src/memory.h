@@ -68,6 +68,9 @@ void dc_civac_range(void *addr, size_t length);
 #define DCSW_OP_DCCSW  0x2
 void dcsw_op_all(u64 op_type);
 
+void memzero_parallel(void *addr, size_t size);
+bool memzero_is_fast(void *addr, size_t size);
+
 void mmu_init(void);
 void mmu_init_secondary(int cpu);
 void mmu_shutdown(void);
@@ -170,8 +170,7 @@ static void free_queue(struct nvme_queue *q)
 
 static void nvme_poll_syslog(void)
 {
-    struct rtkit_message msg;
-    rtkit_recv(nvme_rtkit, &msg);
+    rtkit_poll(nvme_rtkit);
 }
 
 static bool nvme_ctrl_disable(void)
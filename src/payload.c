@@ -11,6 +11,9 @@
 #include "display.h"
 #include "heapblock.h"
 #include "kboot.h"
+#include "lz4.h"
+#include "malloc.h"
+#include "memory.h"
 #include "smp.h"
 #include "utils.h"
 
@@ -23,6 +26,8 @@
 
 static const u8 gz_magic[] = {0x1f, 0x8b};
 static const u8 xz_magic[] = {0xfd, '7', 'z', 'X', 'Z', 0x00};
+static const u8 lz4_magic[] = {0x04, 0x22, 0x4d, 0x18};
+static const u8 lz4_legacy_magic[] = {0x02, 0x21, 0x4c, 0x18};
 static const u8 fdt_magic[] = {0xd0, 0x0d, 0xfe, 0xed};
 static const u8 kernel_magic[] = {'A', 'R', 'M', 0x64};          // at 0x38
 static const u8 cpio_magic[] = {'0', '7', '0', '7', '0'};        // '1' or '2' next
@@ -37,9 +42,27 @@ static char expect_compatible[256];
 static struct kernel_header *kernel = NULL;
 static void *fdt = NULL;
 static char *chainload_spec = NULL;
+static bool cpufreq_done = false;
 
 static void *load_one_payload(void *start, size_t size);
 
+/*
+ * The secondaries are only ever started after the clusters have been set up by cpufreq_init(),
+ * so do that first if they are brought up early to help with decompression.
+ */
+static void prepare_workers(void)
+{
+    if (!mmu_active())
+        return;
+
+    if (!cpufreq_done) {
+        cpufreq_init();
+        cpufreq_done = true;
+    }
+
+    smp_prepare_workers();
+}
+
 static void finalize_uncompression(void *dest, size_t dest_len)
 {
     // Actually reserve the space. malloc is safe after this, but...
@@ -57,10 +80,163 @@ static void finalize_uncompression(void *dest, size_t dest_len)
     }
 }
 
+/*
+ * Blocked gzip (BGZF, as produced by bgzip) is a series of small gzip members, each carrying a
+ * 'BC' extra subfield with its compressed size. The whole stream can therefore be indexed from
+ * the member headers and trailers alone, the output size is known before decoding, and the
+ * members can be inflated independently on all available CPUs.
+ */
+#define GZ_FEXTRA        BIT(2)
+#define GZ_HEADER_SIZE   10
+#define GZ_TRAILER_SIZE  8
+#define BGZF_GRAIN       8
+
+struct bgzf_member {
+    u64 src_off;
+    u64 dst_off;
+    u32 csize;
+    u32 isize;
+};
+
+struct bgzf_job {
+    u8 *src;
+    u8 *dest;
+    struct bgzf_member *members;
+    bool failed;
+};
+
+static u32 bgzf_member_size(const u8 *p, size_t avail)
+{
+    if (avail < GZ_HEADER_SIZE + 2 || memcmp(p, gz_magic, sizeof gz_magic) || p[2] != 8 ||
+        !(p[3] & GZ_FEXTRA))
+        return 0;
+
+    u16 xlen = p[10] | (p[11] << 8);
+    if (xlen > avail - GZ_HEADER_SIZE - 2)
+        return 0;
+
+    const u8 *x = p + 12;
+    const u8 *xend = x + xlen;
+
+    while (xend - x >= 4) {
+        u16 slen = x[2] | (x[3] << 8);
+        if (slen > xend - x - 4)
+            return 0;
+        if (x[0] == 'B' && x[1] == 'C' && slen == 2)
+            return (x[4] | (x[5] << 8)) + 1;
+        x += 4 + slen;
+    }
+
+    return 0;
+}
+
+static size_t bgzf_scan(u8 *p, size_t size, struct bgzf_member *members, u64 *dest_len)
+{
+    size_t count = 0;
+    u64 src_off = 0, dst_off = 0;
+    u32 csize;
+
+    // A zero size means the payload length is not known; only the member headers bound it then
+    while ((csize = bgzf_member_size(p + src_off, size ? size - src_off : ~0UL))) {
+        u32 isize;
+        if (csize < GZ_HEADER_SIZE + GZ_TRAILER_SIZE || (size && src_off + csize > size))
+            break;
+
+        memcpy(&isize, p + src_off + csize - 4, 4);
+
+        if (members) {
+            members[count].src_off = src_off;
+            members[count].dst_off = dst_off;
+            members[count].csize = csize;
+            members[count].isize = isize;
+        }
+
+        count++;
+        src_off += csize;
+        dst_off += isize;
+
+        // BGZF streams are terminated by an empty member
+        if (!isize)
+            break;
+    }
+
+    *dest_len = dst_off;
+    return count;
+}
+
+static void bgzf_inflate(void *arg, u64 start, u64 end)
+{
+    struct bgzf_job *job = arg;
+
+    for (u64 i = start; i < end; i++) {
+        struct bgzf_member *m = &job->members[i];
+        unsigned int dest_len = m->isize, source_len = m->csize;
+
+        int ret = tinf_gzip_uncompress(job->dest + m->dst_off, &dest_len, job->src + m->src_off,
+                                       &source_len);
+        if (ret != TINF_OK || dest_len != m->isize)
+            job->failed = true;
+    }
+}
+
+static void *decompress_bgzf(void *p, size_t size, size_t count)
+{
+    u64 dest_len;
+
+    // Bringing up the worker CPUs allocates their stacks, so it must happen before the index
+    // allocation and the peek at the heap below.
+    prepare_workers();
+
+    // The index must be allocated before claiming the uncompressed region below
+    struct bgzf_member *members = malloc(count * sizeof(*members));
+    if (!members) {
+        printf("Out of memory for BGZF index\n");
+        return NULL;
+    }
+
+    bgzf_scan(p, size, members, &dest_len);
+
+    // Start at the end of the heap area, no allocation yet. The following code must not use
+    // malloc or heapblock, until finalize_uncompression is called.
+    void *dest = heapblock_alloc_aligned(0, KERNEL_ALIGN);
+
+    struct bgzf_job job = {
+        .src = p,
+        .dest = dest,
+        .members = members,
+        .failed = false,
+    };
+
+    printf("Uncompressing %ld BGZF members... ", count);
+    u64 start = get_ticks();
+    int cpus = smp_parallel_for(0, count, BGZF_GRAIN, bgzf_inflate, &job);
+
+    if (job.failed) {
+        printf("Error\n");
+        free(members);
+        return NULL;
+    }
+
+    u64 source_len = members[count - 1].src_off + members[count - 1].csize;
+    // Freeing only returns the chunk to malloc's own pool, it never touches heapblock
+    free(members);
+    printf("%ld bytes uncompressed to %ld bytes on %d CPUs in %ld us\n", source_len, dest_len,
+           cpus, ticks_to_usecs(get_ticks() - start));
+
+    finalize_uncompression(dest, dest_len);
+
+    return ((u8 *)p) + source_len;
+}
+
 static void *decompress_gz(void *p, size_t size)
 {
     unsigned int source_len = size, dest_len = 1 << 30; // 1 GiB should be enough hopefully
 
+    u64 bgzf_len;
+    size_t bgzf_count = bgzf_scan(p, size, NULL, &bgzf_len);
+    if (bgzf_count)
+        return decompress_bgzf(p, size, bgzf_count);
+
     // Start at the end of the heap area, no allocation yet. The following code must not use
     // malloc or heapblock, until finalize_uncompression is called.
     void *dest = heapblock_alloc_aligned(0, KERNEL_ALIGN);
@@ -103,6 +279,33 @@ static void *decompress_xz(void *p, size_t size)
     return ((u8 *)p) + source_len;
 }
 
+static void *decompress_lz4(void *p, size_t size)
+{
+    size_t source_len = size, dest_len = 1 << 30; // 1 GiB should be enough hopefully
+
+    // lz4_decompress() spreads independent blocks over the worker CPUs, which must be brought up
+    // before the heap peek below.
+    prepare_workers();
+
+    // Start at the end of the heap area, no allocation yet. The following code must not use
+    // malloc or heapblock, until finalize_uncompression is called.
+    void *dest = heapblock_alloc_aligned(0, KERNEL_ALIGN);
+
+    printf("Uncompressing... ");
+    u64 start = get_ticks();
+    if (lz4_decompress(dest, &dest_len, p, &source_len)) {
+        printf("LZ4 decode failed\n");
+        return NULL;
+    }
+
+    printf("%ld bytes uncompressed to %ld bytes in %ld us\n", source_len, dest_len,
+           ticks_to_usecs(get_ticks() - start));
+
+    finalize_uncompression(dest, dest_len);
+
+    return ((u8 *)p) + source_len;
+}
+
 static void *load_fdt(void *p, size_t size)
 {
     if (fdt_node_check_compatible(p, 0, expect_compatible) == 0) {
@@ -197,6 +400,8 @@ static bool check_var(u8 **p)
         display_configure(val);
     } else if (IS_VAR("tso=")) {
         enable_tso = val[0] == '1';
+    } else if (IS_VAR("kboot_verbose=")) {
+        kboot_set_verbose(val[0] == '1');
     } else {
         printf("Unknown variable %s\n", *p);
     }
@@ -218,6 +423,10 @@ static void *load_one_payload(void *start, size_t size)
     } else if (!memcmp(p, xz_magic, sizeof xz_magic)) {
         printf("Found an XZ compressed payload at %p\n", p);
         return decompress_xz(p, size);
+    } else if (!memcmp(p, lz4_magic, sizeof lz4_magic) ||
+               !memcmp(p, lz4_legacy_magic, sizeof lz4_legacy_magic)) {
+        printf("Found an LZ4 compressed payload at %p\n", p);
+        return decompress_lz4(p, size);
     } else if (!memcmp(p, fdt_magic, sizeof fdt_magic)) {
         return load_fdt(p, size);
     } else if (!memcmp(p, cpio_magic, sizeof cpio_magic)) {
@@ -280,12 +489,20 @@ int payload_run(void)
     while (p)
         p = load_one_payload(p, 0);
 
+    // Secondaries used to decompress the payloads go back to the MMU-off state the next stage
+    // expects.
+    bool workers = smp_release_workers();
+
     if (chainload_spec) {
+        // The chainloaded m1n1 starts the secondaries on its own
+        if (workers)
+            smp_stop_secondaries(false);
         return chainload_load(chainload_spec, chosen, chosen_cnt);
     }
 
     if (kernel && fdt) {
-        cpufreq_init();
+        if (!cpufreq_done)
+            cpufreq_init();
         smp_start_secondaries();
         if (enable_tso) {
 
@@ -12,6 +12,7 @@
 #include "hv.h"
 #include "iodev.h"
 #include "kboot.h"
+#include "lz4.h"
 #include "malloc.h"
 #include "mcc.h"
 #include "memory.h"
@@ -31,6 +32,161 @@
 #include "minilzlib/minlzma.h"
 #include "tinf/tinf.h"
 
+/*
+ * Arbitrary system register accesses go through a two-instruction stub that is patched with the
+ * requested encoding, so the host does not have to upload and flush code for every MRS/MSR.
+ */
+#define SYSREG_ENC_MASK 0x1fffe0
+#define SYSREG_ENC_OP0  GENMASK(20, 19)
+#define INSN_MRS        0xd5200000
+#define INSN_MSR        0xd5000000
+#define INSN_RET        0xd65f03c0
+
+static u32 sysreg_stub[2] ALIGNED(64);
+
+static u64 sysreg_access(u32 insn, u64 val, u64 flags, bool *fault)
+{
+    if (sysreg_stub[0] != insn || sysreg_stub[1] != INSN_RET) {
+        sysreg_stub[0] = insn;
+        sysreg_stub[1] = INSN_RET;
+        dc_cvau_range(sysreg_stub, sizeof(sysreg_stub));
+        sysop("dsb ish");
+        ic_ivau_range(sysreg_stub, sizeof(sysreg_stub));
+        sysop("dsb ish");
+        sysop("isb");
+    }
+
+    u64 stub = (u64)sysreg_stub;
+    if (mmu_active())
+        stub |= REGION_RX_EL1;
+
+    int count = exc_count;
+    exc_guard = GUARD_SKIP | (flags & GUARD_SILENT);
+    val = ((u64(*)(u64))stub)(val);
+    exc_guard = GUARD_OFF;
+
+    // The fault is reported to the caller, so it must not also show up as a pending exception
+    *fault = exc_count != count;
+    exc_count = count;
+    return val;
+}
+
+static bool sysreg_valid(u64 enc)
+{
+    // op0 == 0 and op0 == 1 encode hints, barriers and SYS instructions, not registers
+    return !(enc & ~SYSREG_ENC_MASK) && FIELD_GET(SYSREG_ENC_OP0, enc) >= 2;
+}
+
+/*
+ * Executable slots for host stubs. The host decides which stub lives in which slot (evicting the
+ * least recently used one), writes it with a plain memory write and sets CODE_SLOT_SYNC on its
+ * first call. Calling a stub that is already resident then takes a single request.
+ */
+#define CODE_SLOT_COUNT   64
+#define CODE_SLOT_SIZE    256
+#define CODE_SLOT_SYNC    BIT(16)
+#define CODE_SLOT_MODE(f) (((f) >> 20) & 0xf)
+
+enum code_slot_mode {
+    CODE_SLOT_EL2 = 0,
+    CODE_SLOT_EL1,
+    CODE_SLOT_EL0,
+    CODE_SLOT_GL2,
+    CODE_SLOT_GL1,
+};
+
+static u32 code_slots[CODE_SLOT_COUNT][CODE_SLOT_SIZE / 4] ALIGNED(64);
+
+static u64 code_slot_call(u64 slot, u64 flags, const u64 *a, bool *fault)
+{
+    u64 code = (u64)code_slots[slot];
+    u64 rx = mmu_active() ? REGION_RX_EL1 : 0;
+    u64 rwx_el0 = mmu_active() ? REGION_RWX_EL0 : 0;
+    u64 ret;
+
+    if (flags & CODE_SLOT_SYNC) {
+        dc_cvau_range(code_slots[slot], CODE_SLOT_SIZE);
+        sysop("dsb ish");
+        ic_ivau_range(code_slots[slot], CODE_SLOT_SIZE);
+        sysop("dsb ish");
+        sysop("isb");
+    }
+
+    int count = exc_count;
+    exc_guard = GUARD_SKIP | (flags & GUARD_SILENT);
+    switch (CODE_SLOT_MODE(flags)) {
+        case CODE_SLOT_EL1:
+            ret = el1_call((void *)code, a[0], a[1], a[2], a[3]);
+            break;
+        case CODE_SLOT_EL0:
+            ret = el0_call((void *)(code | rwx_el0), a[0], a[1], a[2], a[3]);
+            break;
+        case CODE_SLOT_GL2:
+            ret = gl2_call((void *)(code | rx), a[0], a[1], a[2], a[3]);
+            break;
+        case CODE_SLOT_GL1:
+            ret = gl1_call((void *)code, a[0], a[1], a[2], a[3]);
+            break;
+        default:
+            ret = ((generic_func *)(code | rx))(a[0], a[1], a[2], a[3], 0);
+            break;
+    }
+    exc_guard = GUARD_OFF;
+
+    // Reported as S_EXC, like a faulting sysreg access
+    *fault = exc_count != count;
+    exc_count = count;
+    return ret;
+}
+
+/*
+ * Zero fills of large RAM ranges go through memzero_parallel(). Anything else, including all MMIO,
+ * keeps the exact access width of the memset op.
+ */
+static bool memset_zero_fast(void *dst, u64 value, size_t size)
+{
+    if (value || !memzero_is_fast(dst, size))
+        return false;
+
+    memzero_parallel(dst, size);
+    return true;
+}
+
+/*
+ * Compare a register range against a snapshot kept in RAM, updating the snapshot and emitting
+ * {offset, value} pairs for the words that changed (up to out_size bytes worth). Returns the
+ * total number of changed words, or ~0 if reading the range faulted. The fault is only reported
+ * that way: exc_count is left as it was, so it does not show up as a pending exception later.
+ */
+static u64 memdiff32(u64 src, u32 *snap, u64 size, u32 *out, u64 out_size)
+{
+    u64 max = out_size / 8;
+    u64 changed = 0;
+    int count = exc_count;
+
+    exc_guard = GUARD_MARK | GUARD_SILENT;
+    for (u64 i = 0; i < size / 4; i++) {
+        u32 val = read32(src + 4 * i);
+        if (val == snap[i])
+            continue;
+
+        snap[i] = val;
+        if (changed < max) {
+            out[2 * changed] = 4 * i;
+            out[2 * changed + 1] = val;
+        }
+        changed++;
+    }
+    exc_guard = GUARD_OFF;
+
+    if (exc_count != count) {
+        exc_count = count;
+        return ~0UL;
+    }
+
+    return changed;
+}
+
 int proxy_process(ProxyRequest *request, ProxyReply *reply)
 {
     enum exc_guard_t guard_save = exc_guard;
@@ -80,6 +236,50 @@ int proxy_process(ProxyRequest *request, ProxyReply *reply)
             reply->retval = exc_count;
             exc_count = 0;
             break;
+        case P_MRS:
+        case P_MSR: {
+            bool fault;
+            if (!sysreg_valid(request->args[0])) {
+                reply->status = S_BADCMD;
+                break;
+            }
+            u32 insn = (request->opcode == P_MRS ? INSN_MRS : INSN_MSR) | request->args[0];
+            reply->retval = sysreg_access(insn, request->args[1], request->args[2], &fault);
+            if (fault)
+                reply->status = S_EXC;
+            break;
+        }
+        case P_MRS_BATCH: {
+            // args: encodings (u64[count]), results ({value, fault}[count]), count, flags
+            u64 *encs = (u64 *)request->args[0];
+            u64 *out = (u64 *)request->args[1];
+            for (u64 i = 0; i < request->args[2]; i++) {
+                bool fault = true;
+                out[2 * i] = 0;
+                if (sysreg_valid(encs[i]))
+                    out[2 * i] = sysreg_access(INSN_MRS | encs[i], 0, request->args[3], &fault);
+                out[2 * i + 1] = fault;
+                reply->retval += fault;
+            }
+            break;
+        }
+        case P_CODE_SLOT_INFO:
+            reply->retval = (u64)code_slots;
+            break;
+        case P_CODE_SLOT_CALL: {
+            // args: slot, flags (GUARD_SILENT | CODE_SLOT_SYNC | mode << 20), a0..a3
+            bool fault;
+            if (request->args[0] >= CODE_SLOT_COUNT ||
+                CODE_SLOT_MODE(request->args[1]) > CODE_SLOT_GL1) {
+                reply->status = S_BADCMD;
+                break;
+            }
+            reply->retval =
+                code_slot_call(request->args[0], request->args[1], &request->args[2], &fault);
+            if (fault)
+                reply->status = S_EXC;
+            break;
+        }
         case P_EL0_CALL:
             reply->retval = el0_call((void *)request->args[0], request->args[1], request->args[2],
                                      request->args[3], request->args[4]);
@@ -238,19 +438,35 @@ int proxy_process(ProxyRequest *request, ProxyReply *reply)
 
         case P_MEMSET64:
             exc_guard = GUARD_RETURN;
-            memset64((void *)request->args[0], request->args[1], request->args[2]);
+            if (!memset_zero_fast((void *)request->args[0], (u64)request->args[1],
+                                  ALIGN_DOWN(request->args[2], 8)))
+                memset64((void *)request->args[0], request->args[1], request->args[2]);
             break;
         case P_MEMSET32:
             exc_guard = GUARD_RETURN;
-            memset32((void *)request->args[0], request->args[1], request->args[2]);
+            if (!memset_zero_fast((void *)request->args[0], (u32)request->args[1],
+                                  ALIGN_DOWN(request->args[2], 4)))
+                memset32((void *)request->args[0], request->args[1], request->args[2]);
             break;
         case P_MEMSET16:
             exc_guard = GUARD_RETURN;
-            memset16((void *)request->args[0], request->args[1], request->args[2]);
+            if (!memset_zero_fast((void *)request->args[0], (u16)request->args[1],
+                                  ALIGN_DOWN(request->args[2], 2)))
+                memset16((void *)request->args[0], request->args[1], request->args[2]);
             break;
         case P_MEMSET8:
             exc_guard = GUARD_RETURN;
-            memset8((void *)request->args[0], request->args[1], request->args[2]);
+            if (!memset_zero_fast((void *)request->args[0], (u8)request->args[1],
+                                  ALIGN_DOWN(request->args[2], 1)))
+                memset8((void *)request->args[0], request->args[1], request->args[2]);
+            break;
+        case P_MEMZERO:
+            exc_guard = GUARD_RETURN;
+            memzero_parallel((void *)request->args[0], request->args[1]);
+            break;
+        case P_MEMDIFF32:
+            reply->retval = memdiff32(request->args[0], (u32 *)request->args[1], request->args[2],
+                                      (u32 *)request->args[3], request->args[4]);
             break;
 
         case P_IC_IALLUIS:
@@ -324,6 +540,17 @@ int proxy_process(ProxyRequest *request, ProxyReply *reply)
                 reply->retval = destlen;
             break;
         }
+        case P_LZ4DEC: {
+            size_t destlen, srclen;
+            destlen = request->args[3];
+            srclen = request->args[1];
+            if (lz4_decompress((void *)request->args[2], &destlen, (void *)request->args[0],
+                               &srclen))
+                reply->retval = ~0L;
+            else
+                reply->retval = destlen;
+            break;
+        }
 
         case P_SMP_START_SECONDARIES:
             smp_start_secondaries();
@@ -358,6 +585,11 @@ int proxy_process(ProxyRequest *request, ProxyReply *reply)
                       request->args[3], request->args[4]);
             reply->retval = smp_wait(request->args[0]);
             break;
+        case P_SMP_PARALLEL_FOR:
+            reply->retval =
+                smp_parallel_for(request->args[1], request->args[2], request->args[3],
+                                 (smp_work_fn_t)request->args[0], (void *)request->args[4]);
+            break;
 
         case P_HEAPBLOCK_ALLOC:
             reply->retval = (u64)heapblock_alloc(request->args[0]);
@@ -439,6 +671,24 @@ int proxy_process(ProxyRequest *request, ProxyReply *reply)
             reply->retval = tunables_apply_local_addr(
                 (const char *)request->args[0], (const char *)request->args[1], request->args[2]);
             break;
+        case P_TUNABLES_COMPILE_GLOBAL:
+            reply->retval = (u64)tunables_compile_global((const char *)request->args[0],
+                                                         (const char *)request->args[1]);
+            break;
+        case P_TUNABLES_COMPILE_LOCAL:
+            reply->retval = (u64)tunables_compile_local(
+                (const char *)request->args[0], (const char *)request->args[1], request->args[2]);
+            break;
+        case P_TUNABLES_COMPILE_LOCAL_ADDR:
+            reply->retval = (u64)tunables_compile_local_addr(
+                (const char *)request->args[0], (const char *)request->args[1], request->args[2]);
+            break;
+        case P_TUNABLES_APPLY_PROG:
+            reply->retval = tunables_apply_prog((const struct tunable_prog *)request->args[0]);
+            break;
+        case P_TUNABLES_GET_MMIO_SAVED:
+            reply->retval = tunables_get_mmio_saved();
+            break;
 
         case P_DART_INIT:
             reply->retval = (u64)dart_init(request->args[0], request->args[1], request->args[2],
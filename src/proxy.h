@@ -24,6 +24,11 @@ typedef enum {
     P_PUT_SIMD_STATE,
     P_REBOOT,
     P_SLEEP,
+    P_MRS,
+    P_MSR,
+    P_MRS_BATCH,
+    P_CODE_SLOT_INFO,
+    P_CODE_SLOT_CALL,
 
     P_WRITE64 = 0x100, // Generic register functions
     P_WRITE32,
@@ -58,6 +63,8 @@ typedef enum {
     P_MEMSET32,
     P_MEMSET16,
     P_MEMSET8,
+    P_MEMZERO,
+    P_MEMDIFF32,
 
     P_IC_IALLUIS = 0x300, // Cache and memory ops
     P_IC_IALLU,
@@ -78,6 +85,7 @@ typedef enum {
 
     P_XZDEC = 0x400, // Decompression and data processing ops
     P_GZDEC,
+    P_LZ4DEC,
 
     P_SMP_START_SECONDARIES = 0x500, // SMP and system management ops
     P_SMP_CALL,
@@ -88,6 +96,7 @@ typedef enum {
     P_SMP_STOP_SECONDARIES,
     P_SMP_CALL_EL1,
     P_SMP_CALL_EL1_SYNC,
+    P_SMP_PARALLEL_FOR,
 
     P_HEAPBLOCK_ALLOC = 0x600, // Heap and memory management ops
     P_MALLOC,
@@ -116,6 +125,11 @@ typedef enum {
     P_TUNABLES_APPLY_GLOBAL = 0xa00,
     P_TUNABLES_APPLY_LOCAL,
     P_TUNABLES_APPLY_LOCAL_ADDR,
+    P_TUNABLES_COMPILE_GLOBAL,
+    P_TUNABLES_COMPILE_LOCAL,
+    P_TUNABLES_COMPILE_LOCAL_ADDR,
+    P_TUNABLES_APPLY_PROG,
+    P_TUNABLES_GET_MMIO_SAVED,
 
     P_DART_INIT = 0xb00,
     P_DART_SHUTDOWN,
@@ -174,6 +188,7 @@ typedef enum {
 
 #define S_OK     0
 #define S_BADCMD -1
+#define S_EXC    -2
 
 typedef struct {
     u64 opcode;
@@ -72,6 +72,10 @@
 
 #define IOVA_MASK GENMASK(35, 0)
 
+#define RTKIT_APP_EP_BASE   0x20
+#define RTKIT_NUM_APP_EPS   (0x100 - RTKIT_APP_EP_BASE)
+#define RTKIT_POLL_BATCH    32
+
 enum rtkit_power_state {
     RTKIT_POWER_OFF = 0x00,
     RTKIT_POWER_SLEEP = 0x01,
@@ -100,6 +104,11 @@ struct rtkit_dev {
     u32 syslog_cnt, syslog_size;
 
     bool crashed;
+
+    struct {
+        rtkit_ep_handler_t handler;
+        void *priv;
+    } ep_handlers[RTKIT_NUM_APP_EPS];
 };
 
 struct syslog_log {
@@ -345,13 +354,9 @@ static void rtkit_crashed(rtkit_dev_t *rtk)
     }
 }
 
-int rtkit_recv(rtkit_dev_t *rtk, struct rtkit_message *msg)
+static bool rtkit_recv_one(rtkit_dev_t *rtk, struct rtkit_message *msg)
 {
     struct asc_message asc_msg;
-    bool ok = true;
-
-    if (rtk->crashed)
-        return -1;
 
     while (asc_recv(rtk->asc, &asc_msg)) {
         if (asc_msg.msg1 >= 0x100) {
@@ -362,97 +367,168 @@ int rtkit_recv(rtkit_dev_t *rtk, struct rtkit_message *msg)
 
         msg->msg = asc_msg.msg0;
         msg->ep = (u8)asc_msg.msg1;
+        return true;
+    }
 
-        /* if this is an app message we can just forwad it to the caller */
-        if (msg->ep >= 0x20)
+    return false;
+}
+
+/*
+ * Handles system messages and app messages with a registered handler.
+ * Returns 1 if msg is an app message the caller has to deal with, 0 if it was handled.
+ */
+static int rtkit_handle_msg(rtkit_dev_t *rtk, struct rtkit_message *msg)
+{
+    bool ok = true;
+
+    if (msg->ep >= RTKIT_APP_EP_BASE) {
+        rtkit_ep_handler_t handler = rtk->ep_handlers[msg->ep - RTKIT_APP_EP_BASE].handler;
+
+        if (!handler)
             return 1;
 
-        u32 msgtype = FIELD_GET(MGMT_TYPE, msg->msg);
-        switch (msg->ep) {
-            case RTKIT_EP_MGMT:
-                switch (msgtype) {
-                    case MGMT_MSG_IOP_PWR_STATE_ACK:
-                        rtk->iop_power = FIELD_GET(MGMT_PWR_STATE, msg->msg);
-                        break;
-                    case MGMT_MSG_AP_PWR_STATE_ACK:
-                        rtk->ap_power = FIELD_GET(MGMT_PWR_STATE, msg->msg);
-                        break;
-                    default:
-                        rtkit_printf("unknown management message %x\n", msgtype);
-                }
-                break;
-            case RTKIT_EP_SYSLOG:
-                switch (msgtype) {
-                    case MSG_BUFFER_REQUEST:
-                        ok = ok && rtkit_handle_buffer_request(rtk, msg, &rtk->syslog_bfr);
-                        break;
-                    case MSG_SYSLOG_INIT:
-                        rtk->syslog_cnt = FIELD_GET(MSG_SYSLOG_INIT_COUNT, msg->msg);
-                        rtk->syslog_size = FIELD_GET(MSG_SYSLOG_INIT_ENTRYSIZE, msg->msg);
-                        break;
-                    case MSG_SYSLOG_LOG:
+        if (handler(rtk->ep_handlers[msg->ep - RTKIT_APP_EP_BASE].priv, msg) < 0) {
+            rtkit_printf("failed to handle message 0x%02x: %lx\n", msg->ep, msg->msg);
+            return -1;
+        }
+        return 0;
+    }
+
+    u32 msgtype = FIELD_GET(MGMT_TYPE, msg->msg);
+    switch (msg->ep) {
+        case RTKIT_EP_MGMT:
+            switch (msgtype) {
+                case MGMT_MSG_IOP_PWR_STATE_ACK:
+                    rtk->iop_power = FIELD_GET(MGMT_PWR_STATE, msg->msg);
+                    break;
+                case MGMT_MSG_AP_PWR_STATE_ACK:
+                    rtk->ap_power = FIELD_GET(MGMT_PWR_STATE, msg->msg);
+                    break;
+                default:
+                    rtkit_printf("unknown management message %x\n", msgtype);
+            }
+            break;
+        case RTKIT_EP_SYSLOG:
+            switch (msgtype) {
+                case MSG_BUFFER_REQUEST:
+                    ok = rtkit_handle_buffer_request(rtk, msg, &rtk->syslog_bfr);
+                    break;
+                case MSG_SYSLOG_INIT:
+                    rtk->syslog_cnt = FIELD_GET(MSG_SYSLOG_INIT_COUNT, msg->msg);
+                    rtk->syslog_size = FIELD_GET(MSG_SYSLOG_INIT_ENTRYSIZE, msg->msg);
+                    break;
+                case MSG_SYSLOG_LOG:
 #ifdef RTKIT_SYSLOG
-                    {
-                        u64 index = FIELD_GET(MSG_SYSLOG_LOG_INDEX, msg->msg);
-                        u64 stride = rtk->syslog_size + sizeof(struct syslog_log);
-                        struct syslog_log *log = rtk->syslog_bfr.bfr + stride * index;
-                        rtkit_printf("syslog: [%s]%s", log->context, log->msg);
-                        if (log->msg[strlen(log->msg) - 1] != '\n')
-                            printf("\n");
-                    }
-#endif
-                        if (!asc_send(rtk->asc, &asc_msg))
-                            rtkit_printf("failed to ack syslog\n");
-                        break;
-                    default:
-                        rtkit_printf("unknown syslog message %x\n", msgtype);
+                {
+                    u64 index = FIELD_GET(MSG_SYSLOG_LOG_INDEX, msg->msg);
+                    u64 stride = rtk->syslog_size + sizeof(struct syslog_log);
+                    struct syslog_log *log = rtk->syslog_bfr.bfr + stride * index;
+                    rtkit_printf("syslog: [%s]%s", log->context, log->msg);
+                    if (log->msg[strlen(log->msg) - 1] != '\n')
+                        printf("\n");
                 }
-                break;
-            case RTKIT_EP_CRASHLOG:
-                switch (msgtype) {
-                    case MSG_BUFFER_REQUEST:
-                        if (!rtk->crashlog_bfr.bfr) {
-                            ok = ok && rtkit_handle_buffer_request(rtk, msg, &rtk->crashlog_bfr);
-                        } else {
-                            rtkit_crashed(rtk);
-                            return -1;
-                        }
-                        break;
-                    default:
-                        rtkit_printf("unknown crashlog message %x\n", msgtype);
-                }
-                break;
-            case RTKIT_EP_IOREPORT:
-                switch (msgtype) {
-                    case MSG_BUFFER_REQUEST:
-                        ok = ok && rtkit_handle_buffer_request(rtk, msg, &rtk->ioreport_bfr);
-                        break;
-                    /* unknown but must be ACKed */
-                    case 0x8:
-                    case 0xc:
-                        if (!rtkit_send(rtk, msg))
-                            rtkit_printf("unable to ACK unknown ioreport message\n");
-                        break;
-                    default:
-                        rtkit_printf("unknown ioreport message %x\n", msgtype);
-                }
-                break;
-            case RTKIT_EP_OSLOG:
-                rtkit_printf("unknown oslog message %lx\n", msg->msg);
-                break;
-            default:
-                rtkit_printf("message to unknown system endpoint 0x%02x: %lx\n", msg->ep, msg->msg);
-        }
+#endif
+                    if (!rtkit_send(rtk, msg))
+                        rtkit_printf("failed to ack syslog\n");
+                    break;
+                default:
+                    rtkit_printf("unknown syslog message %x\n", msgtype);
+            }
+            break;
+        case RTKIT_EP_CRASHLOG:
+            switch (msgtype) {
+                case MSG_BUFFER_REQUEST:
+                    if (!rtk->crashlog_bfr.bfr) {
+                        ok = rtkit_handle_buffer_request(rtk, msg, &rtk->crashlog_bfr);
+                    } else {
+                        rtkit_crashed(rtk);
+                        return -1;
+                    }
+                    break;
+                default:
+                    rtkit_printf("unknown crashlog message %x\n", msgtype);
+            }
+            break;
+        case RTKIT_EP_IOREPORT:
+            switch (msgtype) {
+                case MSG_BUFFER_REQUEST:
+                    ok = rtkit_handle_buffer_request(rtk, msg, &rtk->ioreport_bfr);
+                    break;
+                /* unknown but must be ACKed */
+                case 0x8:
+                case 0xc:
+                    if (!rtkit_send(rtk, msg))
+                        rtkit_printf("unable to ACK unknown ioreport message\n");
+                    break;
+                default:
+                    rtkit_printf("unknown ioreport message %x\n", msgtype);
+            }
+            break;
+        case RTKIT_EP_OSLOG:
+            rtkit_printf("unknown oslog message %lx\n", msg->msg);
+            break;
+        default:
+            rtkit_printf("message to unknown system endpoint 0x%02x: %lx\n", msg->ep, msg->msg);
+    }
 
-        if (!ok) {
-            rtkit_printf("failed to handle system message 0x%02x: %lx\n", msg->ep, msg->msg);
-            return -1;
-        }
+    if (!ok) {
+        rtkit_printf("failed to handle system message 0x%02x: %lx\n", msg->ep, msg->msg);
+        return -1;
     }
 
     return 0;
 }
 
+int rtkit_recv(rtkit_dev_t *rtk, struct rtkit_message *msg)
+{
+    if (rtk->crashed)
+        return -1;
+
+    while (rtkit_recv_one(rtk, msg)) {
+        int ret = rtkit_handle_msg(rtk, msg);
+        if (ret)
+            return ret;
+    }
+
+    return 0;
+}
+
+int rtkit_poll(rtkit_dev_t *rtk)
+{
+    struct rtkit_message msg;
+    int count = 0;
+
+    if (rtk->crashed)
+        return -1;
+
+    while (count < RTKIT_POLL_BATCH && rtkit_recv_one(rtk, &msg)) {
+        int ret = rtkit_handle_msg(rtk, &msg);
+        if (ret < 0)
+            return ret;
+
+        // Nothing would ever read back messages for endpoints without a handler
+        if (ret > 0)
+            rtkit_printf("unhandled message 0x%02x: %lx\n", msg.ep, msg.msg);
+
+        count++;
+    }
+
+    return count;
+}
+
+bool rtkit_register_ep(rtkit_dev_t *rtk, u8 ep, rtkit_ep_handler_t handler, void *priv)
+{
+    if (ep < RTKIT_APP_EP_BASE) {
+        rtkit_printf("cannot register handler for system endpoint 0x%02x\n", ep);
+        return false;
+    }
+
+    rtk->ep_handlers[ep - RTKIT_APP_EP_BASE].handler = handler;
+    rtk->ep_handlers[ep - RTKIT_APP_EP_BASE].priv = priv;
+
+    return true;
+}
+
 bool rtkit_start_ep(rtkit_dev_t *rtk, u8 ep)
 {
     struct asc_message msg;
@@ -16,6 +16,9 @@ struct rtkit_message {
     u64 msg;
 };
 
+/* Called from rtkit_recv()/rtkit_poll() for each message to the endpoint, < 0 on error */
+typedef int (*rtkit_ep_handler_t)(void *priv, const struct rtkit_message *msg);
+
 struct rtkit_buffer {
     void *bfr;
     u64 dva;
@@ -32,6 +35,8 @@ bool rtkit_start_ep(rtkit_dev_t *rtk, u8 ep);
 bool rtkit_boot(rtkit_dev_t *rtk);
 
 int rtkit_recv(rtkit_dev_t *rtk, struct rtkit_message *msg);
+int rtkit_poll(rtkit_dev_t *rtk);
+bool rtkit_register_ep(rtkit_dev_t *rtk, u8 ep, rtkit_ep_handler_t handler, void *priv);
 bool rtkit_send(rtkit_dev_t *rtk, const struct rtkit_message *msg);
 
 bool rtkit_map(rtkit_dev_t *rtk, void *phys, size_t sz, u64 *dva);
@@ -4,6 +4,7 @@
 #include "adt.h"
 #include "cpu_regs.h"
 #include "malloc.h"
+#include "memory.h"
 #include "pmgr.h"
 #include "soc.h"
 #include "string.h"
@@ -38,6 +39,7 @@ static bool wfe_mode = false;
 static int target_cpu;
 static int cpu_nodes[MAX_CPUS];
 static struct spin_table spin_table[MAX_CPUS];
+static bool worker_mmu[MAX_CPUS];
 static u64 pmgr_reg;
 static u64 cpu_start_off;
 
@@ -155,6 +157,7 @@ static void smp_stop_cpu(int index, int die, int cluster, int core, u64 impl, u6
         udelay(10000);
         printf("  Presumed stopped.\n");
         memset(&spin_table[index], 0, sizeof(struct spin_table));
+        worker_mmu[index] = false;
         return;
     }
 
@@ -172,6 +175,7 @@ static void smp_stop_cpu(int index, int die, int cluster, int core, u64 impl, u6
         printf("  Stopped.\n");
 
         memset(&spin_table[index], 0, sizeof(struct spin_table));
+        worker_mmu[index] = false;
     }
 }
 
@@ -372,3 +376,147 @@ u64 smp_get_release_addr(int cpu)
     target->args[3] = 0;
     return (u64)&target->target;
 }
+
+/*
+ * Fork/join helpers. Only CPUs that are alive and not currently running
+ * something else (e.g. a hypervisor vCPU) take part.
+ */
+u64 smp_fork(void *func, u64 arg)
+{
+    u64 mask = 0;
+
+    for (int cpu = 1; cpu < MAX_CPUS; cpu++) {
+        if (!smp_is_alive(cpu) || spin_table[cpu].target)
+            continue;
+
+        smp_call4(cpu, func, arg, cpu, 0, 0);
+        mask |= BIT(cpu);
+    }
+
+    return mask;
+}
+
+/* Waits for the CPUs started by smp_fork(), returns how many of them returned nonzero. */
+int smp_join(u64 mask)
+{
+    int count = 0;
+
+    for (int cpu = 1; cpu < MAX_CPUS; cpu++)
+        if ((mask & BIT(cpu)) && smp_wait(cpu))
+            count++;
+
+    return count;
+}
+
+/*
+ * smp_parallel_for() only uses secondaries that have the MMU on, which nothing on the normal boot
+ * path gives them. Boot-time callers bring them up with smp_prepare_workers() first, and must call
+ * smp_release_workers() before the secondaries are handed to a next stage, which expects them with
+ * the MMU off.
+ */
+int smp_prepare_workers(void)
+{
+    int count = 0;
+
+    if (!mmu_active())
+        return 0;
+
+    smp_start_secondaries();
+
+    for (int cpu = 1; cpu < MAX_CPUS; cpu++) {
+        if (!smp_is_alive(cpu) || spin_table[cpu].target)
+            continue;
+
+        if (!worker_mmu[cpu]) {
+            mmu_init_secondary(cpu);
+            worker_mmu[cpu] = true;
+        }
+        count++;
+    }
+
+    return count;
+}
+
+bool smp_release_workers(void)
+{
+    bool released = false;
+
+    for (int cpu = 1; cpu < MAX_CPUS; cpu++) {
+        if (!worker_mmu[cpu])
+            continue;
+
+        if (smp_is_alive(cpu)) {
+            smp_call0(cpu, mmu_disable);
+            smp_wait(cpu);
+        }
+        worker_mmu[cpu] = false;
+        released = true;
+    }
+
+    return released;
+}
+
+struct smp_job {
+    smp_work_fn_t fn;
+    void *arg;
+    u64 end;
+    u64 grain;
+    u64 next;
+};
+
+/*
+ * Chunks are handed out from a shared counter, so faster cores (or cores that
+ * got lighter chunks) simply take more of them. Exclusives need cacheable
+ * memory, so CPUs running with the MMU off sit this one out.
+ */
+static u64 smp_job_worker(u64 job_p)
+{
+    struct smp_job *job = (struct smp_job *)job_p;
+    u64 chunks = 0;
+
+    if (!mmu_active())
+        return 0;
+
+    while (1) {
+        u64 start = __atomic_fetch_add(&job->next, job->grain, __ATOMIC_RELAXED);
+        if (start >= job->end)
+            break;
+
+        job->fn(job->arg, start, min(start + job->grain, job->end));
+        chunks++;
+    }
+
+    return chunks;
+}
+
+int smp_parallel_for(u64 start, u64 end, u64 grain, smp_work_fn_t fn, void *arg)
+{
+    if (start >= end)
+        return 0;
+
+    if (!grain)
+        grain = 1;
+
+    if (!mmu_active() || end > (~0UL - grain)) {
+        fn(arg, start, end);
+        return 1;
+    }
+
+    struct smp_job job = {
+        .fn = fn,
+        .arg = arg,
+        .end = end,
+        .grain = grain,
+        .next = start,
+    };
+    sysop("dmb sy");
+
+    u64 mask = smp_fork(smp_job_worker, (u64)&job);
+
+    smp_job_worker((u64)&job);
+
+    int cpus = 1 + smp_join(mask);
+
+    sysop("dmb sy");
+    return cpus;
+}
@@ -31,6 +31,14 @@ u64 smp_get_release_addr(int cpu);
 void smp_set_wfe_mode(bool new_mode);
 void smp_send_ipi(int cpu);
 
+typedef void (*smp_work_fn_t)(void *arg, u64 start, u64 end);
+
+u64 smp_fork(void *func, u64 arg);
+int smp_join(u64 mask);
+int smp_prepare_workers(void);
+bool smp_release_workers(void);
+int smp_parallel_for(u64 start, u64 end, u64 grain, smp_work_fn_t fn, void *arg);
+
 static inline int smp_id(void)
 {
     if (in_el2())
@@ -149,7 +149,8 @@ int tinf_gzip_uncompress(void *dest, unsigned int *destLen,
 	/* -- Check source length if available -- */
 
 	if (*sourceLen) {
-		if ((src + *sourceLen) - start < 8) {
+		/* m1n1: no room for deflate data would read as an unknown length */
+		if ((src + *sourceLen) - start <= 8) {
 			return TINF_DATA_ERROR;
 		}
 		sourceDataLen = (src + *sourceLen) - start - 8;
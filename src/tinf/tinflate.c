@@ -26,9 +26,11 @@
  */
 
 #include "tinf.h"
+#include "../smp.h"
 
 #include <assert.h>
 #include <limits.h>
+#include <string.h>
 
 #if defined(UINT_MAX) && (UINT_MAX) < 0xFFFFFFFFUL
 #  error "tinf requires unsigned int to be at least 32-bit"
@@ -36,16 +38,24 @@
 
 /* -- Internal data structures -- */
 
+/*
+ * m1n1: codes of up to TINF_FAST_BITS bits are decoded with a single table
+ * lookup on the next input bits, longer ones walk the tree a bit at a time.
+ */
+#define TINF_FAST_BITS 9
+
 struct tinf_tree {
 	unsigned short counts[16]; /* Number of codes with a given length */
 	unsigned short symbols[288]; /* Symbols sorted by code */
 	int max_sym;
+	/* (symbol << 4) | code length, indexed by the next input bits, 0 if longer */
+	unsigned short fast[1 << TINF_FAST_BITS];
 };
 
 struct tinf_data {
 	const unsigned char *source;
 	const unsigned char *source_end;
-	unsigned int tag;
+	unsigned long long tag;
 	int bitcount;
 	int overflow;
 
@@ -53,10 +63,17 @@ struct tinf_data {
 	unsigned char *dest;
 	unsigned char *dest_end;
 
-	struct tinf_tree ltree; /* Literal/length tree */
-	struct tinf_tree dtree; /* Distance tree */
+	struct tinf_tree *ltree; /* Literal/length tree */
+	struct tinf_tree *dtree; /* Distance tree */
 };
 
+/*
+ * m1n1: the trees (with their fast tables) are too big for the stack, so
+ * each CPU gets a static pair. BGZF members are inflated on several CPUs
+ * at once.
+ */
+static struct tinf_tree tinf_trees[MAX_CPUS][2];
+
 /* -- Utility functions -- */
 
 static unsigned int read_le16(const unsigned char *p)
@@ -65,6 +82,32 @@ static unsigned int read_le16(const unsigned char *p)
 	     | ((unsigned int) p[1] << 8);
 }
 
+/* Fill in the lookup table for the short codes of a tree */
+static void tinf_build_fast(struct tinf_tree *t)
+{
+	unsigned int len, i, code = 0, sym = 0;
+
+	for (i = 0; i < (1 << TINF_FAST_BITS); ++i) {
+		t->fast[i] = 0;
+	}
+
+	for (len = 1; len <= TINF_FAST_BITS; ++len) {
+		for (i = 0; i < t->counts[len]; ++i, ++code, ++sym) {
+			unsigned int rev = 0, bit;
+
+			/* Codes are stored starting with their most significant bit */
+			for (bit = 0; bit < len; ++bit) {
+				rev |= ((code >> bit) & 1) << (len - 1 - bit);
+			}
+
+			for (; rev < (1 << TINF_FAST_BITS); rev += 1 << len) {
+				t->fast[rev] = (t->symbols[sym] << 4) | len;
+			}
+		}
+		code <<= 1;
+	}
+}
+
 /* Build fixed Huffman trees */
 static void tinf_build_fixed_trees(struct tinf_tree *lt, struct tinf_tree *dt)
 {
@@ -106,6 +149,9 @@ static void tinf_build_fixed_trees(struct tinf_tree *lt, struct tinf_tree *dt)
 	}
 
 	dt->max_sym = 29;
+
+	tinf_build_fast(lt);
+	tinf_build_fast(dt);
 }
 
 /* Given an array of code lengths, build a tree */
@@ -172,6 +218,8 @@ static int tinf_build_tree(struct tinf_tree *t, const unsigned char *lengths,
 		t->symbols[1] = t->max_sym + 1;
 	}
 
+	tinf_build_fast(t);
+
 	return TINF_OK;
 }
 
@@ -184,7 +232,7 @@ static void tinf_refill(struct tinf_data *d, int num)
 	/* Read bytes until at least num bits available */
 	while (d->bitcount < num) {
 		if (d->source != d->source_end) {
-			d->tag |= (unsigned int) *d->source++ << d->bitcount;
+			d->tag |= (unsigned long long) *d->source++ << d->bitcount;
 		}
 		else {
 			d->overflow = 1;
@@ -192,7 +240,43 @@ static void tinf_refill(struct tinf_data *d, int num)
 		d->bitcount += 8;
 	}
 
-	assert(d->bitcount <= 32);
+	assert(d->bitcount <= 64);
+}
+
+/*
+ * m1n1: top up the bit buffer to at least 56 bits, without reading past the
+ * end of the source. Away from the end this is a single 64-bit load; bits
+ * above bitcount already hold the same stream bits, so they can be or'ed in
+ * again. Unused whole bytes are handed back with tinf_rewind().
+ *
+ * With an unknown source length (payloads appended to m1n1) this may read up
+ * to 15 bytes past the end of the stream, which is in RAM either way.
+ */
+static void tinf_fill(struct tinf_data *d)
+{
+	if (!d->source_end || d->source_end - d->source >= 8) {
+		unsigned long long word;
+
+		/* Little-endian, like the bit order of the stream */
+		memcpy(&word, d->source, sizeof(word));
+		d->tag |= word << d->bitcount;
+		d->source += (63 - d->bitcount) >> 3;
+		d->bitcount |= 56;
+		return;
+	}
+
+	while (d->bitcount <= 56 && d->source != d->source_end) {
+		d->tag |= (unsigned long long) *d->source++ << d->bitcount;
+		d->bitcount += 8;
+	}
+}
+
+/* Drop the bits of a partial byte and return whole bytes to the source */
+static void tinf_rewind(struct tinf_data *d)
+{
+	d->source -= d->bitcount >> 3;
+	d->tag = 0;
+	d->bitcount = 0;
 }
 
 static unsigned int tinf_getbits_no_refill(struct tinf_data *d, int num)
@@ -230,6 +314,21 @@ static int tinf_decode_symbol(struct tinf_data *d, const struct tinf_tree *t)
 	int base = 0, offs = 0;
 	int len;
 
+	if (d->bitcount < TINF_FAST_BITS) {
+		tinf_fill(d);
+	}
+
+	/* Near the end of the source, fall back to the bit-wise decode */
+	if (d->bitcount >= TINF_FAST_BITS) {
+		unsigned int entry = t->fast[d->tag & ((1 << TINF_FAST_BITS) - 1)];
+
+		if (entry) {
+			d->tag >>= entry & 15;
+			d->bitcount -= entry & 15;
+			return entry >> 4;
+		}
+	}
+
 	/*
 	 * Get more bits while code index is above number of codes
 	 *
@@ -419,7 +518,14 @@ static int tinf_inflate_block_data(struct tinf_data *d, struct tinf_tree *lt,
 	};
 
 	for (;;) {
-		int sym = tinf_decode_symbol(d, lt);
+		int sym;
+
+		/* Enough bits for a length/distance pair with all extra bits */
+		if (d->bitcount < 48) {
+			tinf_fill(d);
+		}
+
+		sym = tinf_decode_symbol(d, lt);
 
 		/* Check for overflow in bit reader */
 		if (d->overflow) {
@@ -471,9 +577,14 @@ static int tinf_inflate_block_data(struct tinf_data *d, struct tinf_tree *lt,
 				return TINF_BUF_ERROR;
 			}
 
-			/* Copy match */
-			for (i = 0; i < length; ++i) {
-				d->dest[i] = d->dest[i - offs];
+			/* Copy match, overlapping ones repeat the last offs bytes */
+			if (offs >= length) {
+				memcpy(d->dest, d->dest - offs, length);
+			}
+			else {
+				for (i = 0; i < length; ++i) {
+					d->dest[i] = d->dest[i - offs];
+				}
 			}
 
 			d->dest += length;
@@ -486,6 +597,14 @@ static int tinf_inflate_uncompressed_block(struct tinf_data *d)
 {
 	unsigned int length, invlength;
 
+	/* The header bits may already have run past the end of the source */
+	if (d->overflow) {
+		return TINF_DATA_ERROR;
+	}
+
+	/* The block starts on the byte boundary after the bits read so far */
+	tinf_rewind(d);
+
 	if (d->source_end && d->source_end - d->source < 4) {
 		return TINF_DATA_ERROR;
 	}
@@ -516,10 +635,6 @@ static int tinf_inflate_uncompressed_block(struct tinf_data *d)
 		*d->dest++ = *d->source++;
 	}
 
-	/* Make sure we start next block on a byte boundary */
-	d->tag = 0;
-	d->bitcount = 0;
-
 	return TINF_OK;
 }
 
@@ -527,24 +642,24 @@ static int tinf_inflate_uncompressed_block(struct tinf_data *d)
 static int tinf_inflate_fixed_block(struct tinf_data *d)
 {
 	/* Build fixed Huffman trees */
-	tinf_build_fixed_trees(&d->ltree, &d->dtree);
+	tinf_build_fixed_trees(d->ltree, d->dtree);
 
 	/* Decode block using fixed trees */
-	return tinf_inflate_block_data(d, &d->ltree, &d->dtree);
+	return tinf_inflate_block_data(d, d->ltree, d->dtree);
 }
 
 /* Inflate a block of data compressed with dynamic Huffman trees */
 static int tinf_inflate_dynamic_block(struct tinf_data *d)
 {
 	/* Decode trees from stream */
-	int res = tinf_decode_trees(d, &d->ltree, &d->dtree);
+	int res = tinf_decode_trees(d, d->ltree, d->dtree);
 
 	if (res != TINF_OK) {
 		return res;
 	}
 
 	/* Decode block using decoded trees */
-	return tinf_inflate_block_data(d, &d->ltree, &d->dtree);
+	return tinf_inflate_block_data(d, d->ltree, d->dtree);
 }
 
 /* -- Public functions -- */
@@ -576,6 +691,9 @@ int tinf_uncompress(void *dest, unsigned int *destLen,
 	d.dest_start = d.dest;
 	d.dest_end = d.dest + *destLen;
 
+	d.ltree = &tinf_trees[smp_id()][0];
+	d.dtree = &tinf_trees[smp_id()][1];
+
 	do {
 		unsigned int btype;
 		int res;
@@ -615,6 +733,9 @@ int tinf_uncompress(void *dest, unsigned int *destLen,
 		return TINF_DATA_ERROR;
 	}
 
+	/* Whatever is left in the bit buffer was not part of the stream */
+	tinf_rewind(&d);
+
 	if (sourceLen) {
 		unsigned int slen = d.source - (const unsigned char *)source;
 		if (!*sourceLen)
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: MIT */
 
 #include "adt.h"
+#include "malloc.h"
 #include "tunables.h"
 #include "types.h"
 #include "utils.h"
@@ -45,42 +46,116 @@ struct tunable_global {
     u32 value;
 } PACKED;
 
-int tunables_apply_global(const char *path, const char *prop)
+struct tunable_local {
+    u32 offset;
+    u32 size;
+    u64 mask;
+    u64 value;
+} PACKED;
+
+#define MAX_CACHED_REGS 16
+
+static u64 tunables_mmio_saved;
+
+static struct tunable_prog *tunables_prog_alloc(u32 entries)
+{
+    struct tunable_prog *prog = malloc(sizeof(*prog) + entries * sizeof(struct tunable_op));
+    if (!prog) {
+        printf("tunable: out of memory\n");
+        return NULL;
+    }
+
+    prog->count = 0;
+    prog->entries = entries;
+    prog->mmio_ops = 0;
+
+    return prog;
+}
+
+/*
+ * Appends a masked write to the program. Consecutive writes to the same register
+ * are folded into a single read-modify-write, and writes that replace every bit
+ * of the register skip the read entirely. The original entry order is kept,
+ * since tunable sequences may depend on it.
+ */
+static void tunables_prog_add(struct tunable_prog *prog, u64 addr, u8 size, u64 mask, u64 value)
+{
+    u64 full = size == 8 ? ~0UL : (1UL << (size * 8)) - 1;
+    struct tunable_op *op = prog->count ? &prog->ops[prog->count - 1] : NULL;
+
+    mask &= full;
+    value &= full;
+
+    if (op && op->addr == addr && op->size == size) {
+        prog->mmio_ops -= op->mask == full ? 1 : 2;
+        op->value = (op->value & ~mask) | value;
+        op->mask |= mask;
+    } else {
+        op = &prog->ops[prog->count++];
+        op->addr = addr;
+        op->size = size;
+        op->mask = mask;
+        op->value = value;
+    }
+
+    prog->mmio_ops += op->mask == full ? 1 : 2;
+}
+
+struct tunable_prog *tunables_compile_global(const char *path, const char *prop)
 {
     struct tunable_info info;
+    u32 reg_idx[MAX_CACHED_REGS];
+    u64 reg_addr[MAX_CACHED_REGS];
+    u32 cached = 0;
 
     if (tunables_adt_find(path, prop, &info, sizeof(struct tunable_global)) < 0)
-        return -1;
+        return NULL;
+
+    struct tunable_prog *prog = tunables_prog_alloc(info.tunable_len);
+    if (!prog)
+        return NULL;
 
     const struct tunable_global *tunables = (const struct tunable_global *)info.tunable_raw;
     for (u32 i = 0; i < info.tunable_len; ++i) {
         const struct tunable_global *tunable = &tunables[i];
 
+        u32 j;
+        for (j = 0; j < cached; j++)
+            if (reg_idx[j] == tunable->reg_idx)
+                break;
+
         u64 addr;
-        if (adt_get_reg(adt, info.node_path, "reg", tunable->reg_idx, &addr, NULL) < 0) {
-            printf("tunable: Error getting regs with index %d\n", tunable->reg_idx);
-            return -1;
+        if (j < cached) {
+            addr = reg_addr[j];
+        } else {
+            if (adt_get_reg(adt, info.node_path, "reg", tunable->reg_idx, &addr, NULL) < 0) {
+                printf("tunable: Error getting regs with index %d\n", tunable->reg_idx);
+                free(prog);
+                return NULL;
+            }
+            if (cached < MAX_CACHED_REGS) {
+                reg_idx[cached] = tunable->reg_idx;
+                reg_addr[cached++] = addr;
+            }
         }
 
-        mask32(addr + tunable->offset, tunable->mask, tunable->value);
+        tunables_prog_add(prog, addr + tunable->offset, 4, tunable->mask, tunable->value);
     }
 
-    return 0;
+    return prog;
 }
 
-struct tunable_local {
-    u32 offset;
-    u32 size;
-    u64 mask;
-    u64 value;
-} PACKED;
-
-int tunables_apply_local_addr(const char *path, const char *prop, uintptr_t base)
+struct tunable_prog *tunables_compile_local_addr(const char *path, const char *prop,
+                                                 uintptr_t base)
 {
     struct tunable_info info;
 
     if (tunables_adt_find(path, prop, &info, sizeof(struct tunable_local)) < 0)
-        return -1;
+        return NULL;
+
+    struct tunable_prog *prog = tunables_prog_alloc(info.tunable_len);
+    if (!prog)
+        return NULL;
 
     const struct tunable_local *tunables = (const struct tunable_local *)info.tunable_raw;
     for (u32 i = 0; i < info.tunable_len; ++i) {
@@ -88,37 +163,112 @@ int tunables_apply_local_addr(const char *path, const char *prop, uintptr_t base
 
         switch (tunable->size) {
             case 1:
-                mask8(base + tunable->offset, tunable->mask, tunable->value);
-                break;
             case 2:
-                mask16(base + tunable->offset, tunable->mask, tunable->value);
-                break;
             case 4:
-                mask32(base + tunable->offset, tunable->mask, tunable->value);
-                break;
             case 8:
-                mask64(base + tunable->offset, tunable->mask, tunable->value);
+                tunables_prog_add(prog, base + tunable->offset, tunable->size, tunable->mask,
+                                  tunable->value);
                 break;
             default:
                 printf("tunable: unknown tunable size 0x%08x\n", tunable->size);
-                return -1;
+                free(prog);
+                return NULL;
         }
     }
-    return 0;
+
+    return prog;
 }
 
-int tunables_apply_local(const char *path, const char *prop, u32 reg_offset)
+struct tunable_prog *tunables_compile_local(const char *path, const char *prop, u32 reg_idx)
 {
-    struct tunable_info info;
+    int node_path[8];
 
-    if (tunables_adt_find(path, prop, &info, sizeof(struct tunable_local)) < 0)
-        return -1;
+    int node = adt_path_offset_trace(adt, path, node_path);
+    if (node < 0) {
+        printf("tunable: unable to find ADT node %s.\n", path);
+        return NULL;
+    }
 
     u64 base;
-    if (adt_get_reg(adt, info.node_path, "reg", reg_offset, &base, NULL) < 0) {
+    if (adt_get_reg(adt, node_path, "reg", reg_idx, &base, NULL) < 0) {
         printf("tunable: Error getting regs\n");
-        return -1;
+        return NULL;
     }
 
-    return tunables_apply_local_addr(path, prop, base);
+    return tunables_compile_local_addr(path, prop, base);
+}
+
+int tunables_apply_prog(const struct tunable_prog *prog)
+{
+    for (u32 i = 0; i < prog->count; i++) {
+        const struct tunable_op *op = &prog->ops[i];
+        u64 full = op->size == 8 ? ~0UL : (1UL << (op->size * 8)) - 1;
+
+        if (op->mask == full) {
+            switch (op->size) {
+                case 1:
+                    write8(op->addr, op->value);
+                    break;
+                case 2:
+                    write16(op->addr, op->value);
+                    break;
+                case 4:
+                    write32(op->addr, op->value);
+                    break;
+                case 8:
+                    write64(op->addr, op->value);
+                    break;
+            }
+        } else {
+            switch (op->size) {
+                case 1:
+                    mask8(op->addr, op->mask, op->value);
+                    break;
+                case 2:
+                    mask16(op->addr, op->mask, op->value);
+                    break;
+                case 4:
+                    mask32(op->addr, op->mask, op->value);
+                    break;
+                case 8:
+                    mask64(op->addr, op->mask, op->value);
+                    break;
+            }
+        }
+    }
+
+    tunables_mmio_saved += 2 * prog->entries - prog->mmio_ops;
+
+    return 0;
+}
+
+u64 tunables_get_mmio_saved(void)
+{
+    return tunables_mmio_saved;
+}
+
+static int tunables_apply_and_free(struct tunable_prog *prog)
+{
+    if (!prog)
+        return -1;
+
+    int ret = tunables_apply_prog(prog);
+    free(prog);
+
+    return ret;
+}
+
+int tunables_apply_global(const char *path, const char *prop)
+{
+    return tunables_apply_and_free(tunables_compile_global(path, prop));
+}
+
+int tunables_apply_local_addr(const char *path, const char *prop, uintptr_t base)
+{
+    return tunables_apply_and_free(tunables_compile_local_addr(path, prop, base));
+}
+
+int tunables_apply_local(const char *path, const char *prop, u32 reg_offset)
+{
+    return tunables_apply_and_free(tunables_compile_local(path, prop, reg_offset));
 }
@@ -5,6 +5,25 @@
 
 #include "types.h"
 
+struct tunable_op {
+    u64 addr;
+    u64 mask;
+    u64 value;
+    u8 size;
+};
+
+/*
+ * A set of tunables resolved to absolute addresses, with consecutive writes to
+ * the same register merged. entries is the number of tunables that went in,
+ * mmio_ops the number of MMIO accesses needed to apply the program.
+ */
+struct tunable_prog {
+    u32 count;
+    u32 entries;
+    u32 mmio_ops;
+    struct tunable_op ops[];
+};
+
 /*
  * This function applies the tunables usually passed in the node "tunable".
  * They usually apply to multiple entries from the "reg" node.
@@ -37,6 +56,20 @@ int tunables_apply_local(const char *path, const char *prop, u32 reg_idx);
  */
 int tunables_apply_local_addr(const char *path, const char *prop, uintptr_t base);
 
+/*
+ * These compile the same tunables as the tunables_apply_* functions into a
+ * program that can be applied repeatedly with tunables_apply_prog() without
+ * looking anything up in the ADT again. Free the result with free().
+ */
+struct tunable_prog *tunables_compile_global(const char *path, const char *prop);
+struct tunable_prog *tunables_compile_local(const char *path, const char *prop, u32 reg_idx);
+struct tunable_prog *tunables_compile_local_addr(const char *path, const char *prop,
+                                                 uintptr_t base);
+int tunables_apply_prog(const struct tunable_prog *prog);
+
+/* Total MMIO accesses saved by merging, compared to one read-modify-write per tunable */
+u64 tunables_get_mmio_saved(void);
+
 int tunables_apply_static(void);
 
 #endif
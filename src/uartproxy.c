@@ -3,11 +3,14 @@
 #include "uartproxy.h"
 #include "assert.h"
 #include "exception.h"
+#include "fb.h"
 #include "iodev.h"
+#include "memory.h"
 #include "proxy.h"
 #include "string.h"
 #include "types.h"
 #include "utils.h"
+#include "xnuboot.h"
 
 #define REQ_SIZE 64
 
@@ -49,6 +52,14 @@ typedef struct {
     u16 event_type;
 } UartEventHdr;
 
+// Sent after every REQ_PROXY reply when PROXY_FEAT_EXC_INFO is enabled
+typedef struct {
+    u64 esr;
+    u64 far;
+    u32 count;
+    u32 checksum;
+} UartExcInfo;
+
 static_assert(sizeof(UartReply) == (REPLY_SIZE + 4), "Invalid UartReply size");
 
 #define REQ_NOP      0x00AA55FF
@@ -65,7 +76,8 @@ static_assert(sizeof(UartReply) == (REPLY_SIZE + 4), "Invalid UartReply size");
 #define ST_CSUMERR -4
 
 #define PROXY_FEAT_DISABLE_DATA_CSUMS 0x01
-#define PROXY_FEAT_ALL                (PROXY_FEAT_DISABLE_DATA_CSUMS)
+#define PROXY_FEAT_EXC_INFO           0x02
+#define PROXY_FEAT_ALL                (PROXY_FEAT_DISABLE_DATA_CSUMS | PROXY_FEAT_EXC_INFO)
 
 static u32 iodev_proxy_buffer[IODEV_MAX];
 
@@ -75,6 +87,7 @@ static u32 iodev_proxy_buffer[IODEV_MAX];
 #define DATA_END_SENTINEL 0xB0CACC10
 
 static bool disable_data_csums = false;
+static bool send_exc_info = false;
 
 // I just totally pulled this out of my arse
 // Noinline so that this can be bailed out by exc_guard = EXC_RETURN
@@ -111,6 +124,14 @@ static inline u32 checksum(void *start, u32 length)
     return checksum_finish(checksum_start(start, length));
 }
 
+// Only plain RAM may be handed to the iodev for DMA, anything else goes through the CPU
+static bool is_dma_safe(u64 addr, u64 size)
+{
+    u64 ram_end = ram_base + cur_boot_args.mem_size_actual;
+
+    return addr >= ram_base && addr < ram_end && size <= ram_end - addr;
+}
+
 static u64 data_checksum(void *start, u32 length)
 {
     if (disable_data_csums) {
@@ -129,6 +150,7 @@ int uartproxy_run(struct uartproxy_msg_start *start)
     size_t bytes;
     u64 checksum_val;
     u64 enabled_features = 0;
+    int exc_start = 0;
 
     iodev_id_t iodev = IODEV_MAX;
 
@@ -161,8 +183,12 @@ int uartproxy_run(struct uartproxy_msg_start *start)
                     }
                 }
                 iodev++;
-                if (iodev == IODEV_MAX)
+                if (iodev == IODEV_MAX) {
+                    // Idle: let the framebuffer console render pending output
+                    if (fb_console_pending())
+                        iodev_handle_events(IODEV_FB);
                     iodev = 0;
+                }
             }
         } else {
             // Stick to the current iodev for exceptions
@@ -208,9 +234,11 @@ int uartproxy_run(struct uartproxy_msg_start *start)
                 }
 
                 disable_data_csums = enabled_features & PROXY_FEAT_DISABLE_DATA_CSUMS;
+                send_exc_info = enabled_features & PROXY_FEAT_EXC_INFO;
                 reply.features = enabled_features;
                 break;
             case REQ_PROXY:
+                exc_start = exc_count;
                 ret = proxy_process(&request.prequest, &reply.preply);
                 if (ret != 0)
                     running = 0;
@@ -242,7 +270,11 @@ int uartproxy_run(struct uartproxy_msg_start *start)
                     reply.status = ST_XFRERR;
                     break;
                 }
-                bytes = iodev_read(iodev, (void *)request.mrequest.addr, request.mrequest.size);
+                if (is_dma_safe(request.mrequest.addr, request.mrequest.size))
+                    bytes = iodev_read_direct(iodev, (void *)request.mrequest.addr,
+                                              request.mrequest.size);
+                else
+                    bytes = iodev_read(iodev, (void *)request.mrequest.addr, request.mrequest.size);
                 if (bytes != request.mrequest.size) {
                     reply.status = ST_XFRERR;
                     break;
@@ -273,8 +305,24 @@ int uartproxy_run(struct uartproxy_msg_start *start)
         iodev_lock(uartproxy_iodev);
         iodev_queue(iodev, &reply, REPLY_SIZE);
 
+        if (request.type == REQ_PROXY && send_exc_info) {
+            UartExcInfo info = {0};
+
+            // P_SET_EXC_GUARD and P_GET_EXC_COUNT reset the counter
+            info.count = exc_count >= exc_start ? exc_count - exc_start : exc_count;
+            if (info.count) {
+                info.esr = exc_last_esr;
+                info.far = exc_last_far;
+            }
+            info.checksum = checksum(&info, sizeof(info) - 4);
+            iodev_queue(iodev, &info, sizeof(info));
+        }
+
         if ((request.type == REQ_MEMREAD) && (reply.status == ST_OK)) {
-            iodev_queue(iodev, (void *)request.mrequest.addr, request.mrequest.size);
+            if (is_dma_safe(request.mrequest.addr, request.mrequest.size))
+                iodev_write_direct(iodev, (void *)request.mrequest.addr, request.mrequest.size);
+            else
+                iodev_queue(iodev, (void *)request.mrequest.addr, request.mrequest.size);
 
             if (disable_data_csums) {
                 // Since there is no checksum, put a sentinel after the data so the receiver
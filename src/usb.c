@@ -180,9 +180,20 @@ dwc3_dev_t *usb_iodev_bringup(u32 idx)
     static void usb_##name##_flush(void *dev)                                                      \
     {                                                                                              \
         usb_dwc3_flush(dev, pipe);                                                                 \
+    }                                                                                              \
+                                                                                                   \
+    static ssize_t usb_##name##_read_direct(void *dev, void *buf, size_t count)                    \
+    {                                                                                              \
+        return usb_dwc3_read_direct(dev, pipe, buf, count);                                        \
+    }                                                                                              \
+                                                                                                   \
+    static ssize_t usb_##name##_write_direct(void *dev, const void *buf, size_t count)             \
+    {                                                                                              \
+        return usb_dwc3_write_direct(dev, pipe, buf, count);                                       \
     }
 
-USB_IODEV_WRAPPER(0, CDC_ACM_PIPE_0)
+// The primary pipe follows the vendor interface whenever the host has opened it
+USB_IODEV_WRAPPER(0, usb_dwc3_proxy_pipe(dev))
 USB_IODEV_WRAPPER(1, CDC_ACM_PIPE_1)
 
 static struct iodev_ops iodev_usb_ops = {
@@ -193,6 +204,8 @@ static struct iodev_ops iodev_usb_ops = {
     .queue = usb_0_queue,
     .flush = usb_0_flush,
     .handle_events = usb_0_handle_events,
+    .read_direct = usb_0_read_direct,
+    .write_direct = usb_0_write_direct,
 };
 
 static struct iodev_ops iodev_usb_sec_ops = {
@@ -203,6 +216,8 @@ static struct iodev_ops iodev_usb_sec_ops = {
     .queue = usb_1_queue,
     .flush = usb_1_flush,
     .handle_events = usb_1_handle_events,
+    .read_direct = usb_1_read_direct,
+    .write_direct = usb_1_write_direct,
 };
 
 struct iodev iodev_usb_vuart = {
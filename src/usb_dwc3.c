@@ -42,6 +42,11 @@
 #define CDC_INTERFACE_PROTOCOL_NONE 0x00
 #define CDC_INTERFACE_PROTOCOL_AT   0x01
 
+#define VENDOR_INTERFACE_CLASS 0xff
+
+/* vendor interface control request: wValue = 1 opens the pipe, 0 closes it */
+#define USB_REQUEST_VENDOR_SET_READY 0x01
+
 #define DWC3_SCRATCHPAD_SIZE SZ_16K
 #define TRB_BUFFER_SIZE      SZ_16K
 #define XFER_BUFFER_SIZE     (SZ_16K * MAX_ENDPOINTS * 2)
@@ -52,10 +57,23 @@
 
 #define XFER_SIZE SZ_16K
 
+/* bulk endpoints alternate between these halves of their transfer buffer */
+#define XFER_BUFFERS_PER_EP (XFER_BUFFER_BYTES_PER_EP / XFER_SIZE)
+
+/*
+ * Direct transfers DMA straight from/to the caller's buffer through a temporary DART
+ * mapping instead of bouncing through the transfer buffers and ringbuffers.
+ */
+#define DIRECT_TRB_IDX    XFER_BUFFERS_PER_EP
+#define DIRECT_XFER_SIZE  (4 * SZ_1M)
+#define DIRECT_MIN_SIZE   (4 * SZ_16K)
+#define BULK_MAX_PACKET   512
+
 #define SCRATCHPAD_IOVA   0xbeef0000
 #define EVENT_BUFFER_IOVA 0xdead0000
 #define XFER_BUFFER_IOVA  0xbabe0000
 #define TRB_BUFFER_IOVA   0xf00d0000
+#define DIRECT_IOVA       0x10000000
 
 /* these map to the control endpoint 0x00/0x80 */
 #define USB_LEP_CTRL_OUT 0
@@ -75,6 +93,10 @@
 #define USB_LEP_CDC_BULK_OUT_2 8
 #define USB_LEP_CDC_BULK_IN_2  9
 
+/* these map to physical endpoints 0x05 and 0x85 */
+#define USB_LEP_VENDOR_BULK_OUT 10
+#define USB_LEP_VENDOR_BULK_IN  11
+
 /* content doesn't matter at all, this is the setting linux writes by default */
 static const u8 cdc_default_line_coding[] = {0x80, 0x25, 0x00, 0x00, 0x00, 0x00, 0x08};
 
@@ -118,6 +140,14 @@ typedef struct dwc3_dev {
 
         struct dwc3_trb *trb;
         uintptr_t trb_iova;
+
+        /* bulk double buffering: buffer index of the current (or last) transfer */
+        u8 xfer_idx;
+        /* IN only: the other buffer already holds the next transfer */
+        bool staged;
+        u32 staged_len;
+        /* bulk: a direct transfer owns the endpoint, don't arm the transfer buffers */
+        bool direct;
     } endpoints[MAX_ENDPOINTS];
 
     struct {
@@ -160,6 +190,9 @@ struct cdc_dev_desc {
     const struct usb_interface_descriptor sec_interface_data;
     const struct usb_endpoint_descriptor sec_endpoint_data_in;
     const struct usb_endpoint_descriptor sec_endpoint_data_out;
+    const struct usb_interface_descriptor vendor_interface;
+    const struct usb_endpoint_descriptor vendor_endpoint_out;
+    const struct usb_endpoint_descriptor vendor_endpoint_in;
 } PACKED;
 
 static const struct usb_device_descriptor usb_cdc_device_descriptor = {
@@ -185,7 +218,7 @@ static const struct cdc_dev_desc cdc_configuration_descriptor = {
             .bLength = sizeof(cdc_configuration_descriptor.configuration),
             .bDescriptorType = USB_CONFIGURATION_DESCRIPTOR,
             .wTotalLength = sizeof(cdc_configuration_descriptor),
-            .bNumInterfaces = 4,
+            .bNumInterfaces = 5,
             .bConfigurationValue = 1,
             .iConfiguration = 0,
             .bmAttributes = USB_CONFIGURATION_ATTRIBUTE_RES1 | USB_CONFIGURATION_SELF_POWERED,
@@ -329,6 +362,41 @@ static const struct cdc_dev_desc cdc_configuration_descriptor = {
             .wMaxPacketSize = 512,
             .bInterval = 10,
         },
+
+    /*
+     * vendor-class bulk interface carrying the proxy protocol without any tty in between
+     */
+
+    .vendor_interface =
+        {
+            .bLength = sizeof(cdc_configuration_descriptor.vendor_interface),
+            .bDescriptorType = USB_INTERFACE_DESCRIPTOR,
+            .bInterfaceNumber = 4,
+            .bAlternateSetting = 0,
+            .bNumEndpoints = 2,
+            .bInterfaceClass = VENDOR_INTERFACE_CLASS,
+            .bInterfaceSubClass = 0,
+            .bInterfaceProtocol = 0,
+            .iInterface = 0,
+        },
+    .vendor_endpoint_out =
+        {
+            .bLength = sizeof(cdc_configuration_descriptor.vendor_endpoint_out),
+            .bDescriptorType = USB_ENDPOINT_DESCRIPTOR,
+            .bEndpointAddress = USB_ENDPOINT_ADDR_OUT(5),
+            .bmAttributes = USB_ENDPOINT_ATTR_TYPE_BULK,
+            .wMaxPacketSize = 512,
+            .bInterval = 10,
+        },
+    .vendor_endpoint_in =
+        {
+            .bLength = sizeof(cdc_configuration_descriptor.vendor_endpoint_in),
+            .bDescriptorType = USB_ENDPOINT_DESCRIPTOR,
+            .bEndpointAddress = USB_ENDPOINT_ADDR_IN(5),
+            .bmAttributes = USB_ENDPOINT_ATTR_TYPE_BULK,
+            .wMaxPacketSize = 512,
+            .bInterval = 10,
+        },
 };
 
 static const struct usb_device_qualifier_descriptor usb_cdc_device_qualifier_descriptor = {
@@ -634,6 +702,8 @@ static void usb_dwc3_ep0_handle_standard_device(dwc3_dev_t *dev,
                     clear32(dev->regs + DWC3_DALEPENA, DWC3_DALEPENA_EP(USB_LEP_CDC_BULK_OUT_2));
                     clear32(dev->regs + DWC3_DALEPENA, DWC3_DALEPENA_EP(USB_LEP_CDC_BULK_IN_2));
                     clear32(dev->regs + DWC3_DALEPENA, DWC3_DALEPENA_EP(USB_LEP_CDC_INTR_IN_2));
+                    clear32(dev->regs + DWC3_DALEPENA, DWC3_DALEPENA_EP(USB_LEP_VENDOR_BULK_OUT));
+                    clear32(dev->regs + DWC3_DALEPENA, DWC3_DALEPENA_EP(USB_LEP_VENDOR_BULK_IN));
                     dev->ep0_state = USB_DWC3_EP0_STATE_DATA_SEND_STATUS;
                     for (int i = 0; i < CDC_ACM_PIPE_MAX; i++)
                         dev->pipe[i].ready = false;
@@ -647,6 +717,8 @@ static void usb_dwc3_ep0_handle_standard_device(dwc3_dev_t *dev,
                     set32(dev->regs + DWC3_DALEPENA, DWC3_DALEPENA_EP(USB_LEP_CDC_BULK_OUT_2));
                     set32(dev->regs + DWC3_DALEPENA, DWC3_DALEPENA_EP(USB_LEP_CDC_BULK_IN_2));
                     set32(dev->regs + DWC3_DALEPENA, DWC3_DALEPENA_EP(USB_LEP_CDC_INTR_IN_2));
+                    set32(dev->regs + DWC3_DALEPENA, DWC3_DALEPENA_EP(USB_LEP_VENDOR_BULK_OUT));
+                    set32(dev->regs + DWC3_DALEPENA, DWC3_DALEPENA_EP(USB_LEP_VENDOR_BULK_IN));
                     dev->ep0_state = USB_DWC3_EP0_STATE_DATA_SEND_STATUS;
                     break;
                 default:
@@ -793,6 +865,28 @@ static void usb_dwc3_ep0_handle_class(dwc3_dev_t *dev, const union usb_setup_pac
     }
 }
 
+static void usb_dwc3_ep0_handle_vendor(dwc3_dev_t *dev, const union usb_setup_packet *setup)
+{
+    switch (setup->raw.bRequest) {
+        case USB_REQUEST_VENDOR_SET_READY:
+            if (setup->raw.wValue & 1) {
+                usb_debug_printf("vendor pipe opened\n");
+                dev->pipe[USB_VENDOR_PIPE].ready = true;
+            } else {
+                dev->pipe[USB_VENDOR_PIPE].ready = false;
+                usb_debug_printf("vendor pipe closed\n");
+            }
+            usb_dwc3_start_status_phase(dev, USB_LEP_CTRL_IN);
+            dev->ep0_state = USB_DWC3_EP0_STATE_DATA_SEND_STATUS_DONE;
+            break;
+
+        default:
+            usb_dwc3_ep_set_stall(dev, 0, 1);
+            dev->ep0_state = USB_DWC3_EP0_STATE_IDLE;
+            usb_debug_printf("unsupported SETUP packet\n");
+    }
+}
+
 static void usb_dwc3_ep0_handle_setup(dwc3_dev_t *dev)
 {
     const union usb_setup_packet *setup = dev->endpoints[0].xfer_buffer;
@@ -804,6 +898,9 @@ static void usb_dwc3_ep0_handle_setup(dwc3_dev_t *dev)
         case USB_REQUEST_TYPE_CLASS:
             usb_dwc3_ep0_handle_class(dev, setup);
             break;
+        case USB_REQUEST_TYPE_VENDOR:
+            usb_dwc3_ep0_handle_vendor(dev, setup);
+            break;
         default:
             usb_debug_printf("unsupported request type\n");
             usb_dwc3_ep_set_stall(dev, 0, 1);
@@ -895,17 +992,75 @@ ringbuffer_t *usb_dwc3_cdc_get_ringbuffer(dwc3_dev_t *dev, u8 endpoint_number)
             return dev->pipe[CDC_ACM_PIPE_1].device2host;
         case USB_LEP_CDC_BULK_OUT_2:
             return dev->pipe[CDC_ACM_PIPE_1].host2device;
+        case USB_LEP_VENDOR_BULK_IN:
+            return dev->pipe[USB_VENDOR_PIPE].device2host;
+        case USB_LEP_VENDOR_BULK_OUT:
+            return dev->pipe[USB_VENDOR_PIPE].host2device;
         default:
             return NULL;
     }
 }
 
-static void usb_dwc3_cdc_start_bulk_out_xfer(dwc3_dev_t *dev, u8 endpoint_number)
+static void *usb_dwc3_bulk_buffer(dwc3_dev_t *dev, u8 ep, u8 idx)
 {
-    struct dwc3_trb *trb;
-    uintptr_t trb_iova;
+    return dev->endpoints[ep].xfer_buffer + idx * XFER_SIZE;
+}
+
+static int usb_dwc3_bulk_run_trb(dwc3_dev_t *dev, u8 ep, u8 idx, u64 iova, u32 len)
+{
+    struct dwc3_trb *trb = &dev->endpoints[ep].trb[idx];
+    uintptr_t trb_iova = dev->endpoints[ep].trb_iova + idx * sizeof(*trb);
+
+    trb->ctrl = DWC3_TRB_CTRL_HWO | DWC3_TRB_CTRL_ISP_IMI | DWC3_TRB_CTRL_LST | DWC3_TRBCTL_NORMAL;
+    trb->size = DWC3_TRB_SIZE_LENGTH(len);
+    trb->bph = iova >> 32;
+    trb->bpl = iova;
+
+    dev->endpoints[ep].xfer_idx = idx;
+    return usb_dwc3_ep_start_transfer(dev, ep, trb_iova);
+}
 
-    if (dev->endpoints[endpoint_number].xfer_in_progress)
+static int usb_dwc3_bulk_start_transfer(dwc3_dev_t *dev, u8 ep, u8 idx, u32 len)
+{
+    return usb_dwc3_bulk_run_trb(dev, ep, idx,
+                                 dev->endpoints[ep].xfer_buffer_iova + idx * XFER_SIZE, len);
+}
+
+/*
+ * Map buf through DIRECT_IOVA, run a single bulk transfer on it and wait for completion.
+ * Returns the number of bytes transferred, or -1 if the buffer could not be mapped, the transfer
+ * could not be started or a bus reset aborted it.
+ */
+static ssize_t usb_dwc3_bulk_direct_xfer(dwc3_dev_t *dev, u8 ep, uintptr_t buf, u32 len)
+{
+    uintptr_t page = ALIGN_DOWN(buf, SZ_16K);
+    size_t map_len = ALIGN_UP(buf + len, SZ_16K) - page;
+    struct dwc3_trb *trb = &dev->endpoints[ep].trb[DIRECT_TRB_IDX];
+
+    if (dart_map(dev->dart, DIRECT_IOVA, (void *)page, map_len))
+        return -1;
+
+    if (usb_dwc3_bulk_run_trb(dev, ep, DIRECT_TRB_IDX, DIRECT_IOVA + (buf - page), len)) {
+        dart_unmap(dev->dart, DIRECT_IOVA, map_len);
+        return -1;
+    }
+
+    while (dev->endpoints[ep].xfer_in_progress)
+        usb_dwc3_handle_events(dev);
+
+    dart_unmap(dev->dart, DIRECT_IOVA, map_len);
+
+    /* a bus reset ends the transfer and zeroes the TRB, which would read back as complete */
+    if (!dev->endpoints[ep].direct)
+        return -1;
+
+    return len - DWC3_TRB_SIZE_LENGTH(trb->size);
+}
+
+static void usb_dwc3_cdc_start_bulk_out_xfer(dwc3_dev_t *dev, u8 endpoint_number)
+{
+    if (dev->endpoints[endpoint_number].xfer_in_progress ||
+        dev->endpoints[endpoint_number].direct)
         return;
 
     ringbuffer_t *host2device = usb_dwc3_cdc_get_ringbuffer(dev, endpoint_number);
@@ -915,51 +1070,80 @@ static void usb_dwc3_cdc_start_bulk_out_xfer(dwc3_dev_t *dev, u8 endpoint_number
     if (ringbuffer_get_free(host2device) < XFER_SIZE)
         return;
 
-    memset(dev->endpoints[endpoint_number].xfer_buffer, 0xaa, XFER_SIZE);
-    trb_iova = usb_dwc3_init_trb(dev, endpoint_number, &trb);
-    trb->ctrl |= DWC3_TRBCTL_NORMAL;
-    trb->size = DWC3_TRB_SIZE_LENGTH(XFER_SIZE);
+    usb_dwc3_bulk_start_transfer(dev, endpoint_number,
+                                 (dev->endpoints[endpoint_number].xfer_idx + 1) %
+                                     XFER_BUFFERS_PER_EP,
+                                 XFER_SIZE);
+}
 
-    usb_dwc3_ep_start_transfer(dev, endpoint_number, trb_iova);
-    dev->endpoints[endpoint_number].xfer_in_progress = true;
+/*
+ * Move pending data from the ringbuffer into the idle half of the transfer buffer,
+ * so that the next IN transfer can be started as soon as the current one completes.
+ */
+static void usb_dwc3_cdc_stage_bulk_in_xfer(dwc3_dev_t *dev, u8 endpoint_number,
+                                            ringbuffer_t *device2host)
+{
+    if (dev->endpoints[endpoint_number].staged)
+        return;
+
+    u8 idx = (dev->endpoints[endpoint_number].xfer_idx + 1) % XFER_BUFFERS_PER_EP;
+    size_t len =
+        ringbuffer_read(usb_dwc3_bulk_buffer(dev, endpoint_number, idx), XFER_SIZE, device2host);
+
+    if (!len && !dev->endpoints[endpoint_number].zlp_pending)
+        return;
+
+    dev->endpoints[endpoint_number].staged = true;
+    dev->endpoints[endpoint_number].staged_len = len;
 }
 
 static void usb_dwc3_cdc_start_bulk_in_xfer(dwc3_dev_t *dev, u8 endpoint_number)
 {
-    struct dwc3_trb *trb;
-    uintptr_t trb_iova;
-
-    if (dev->endpoints[endpoint_number].xfer_in_progress)
+    if (dev->endpoints[endpoint_number].direct)
         return;
 
     ringbuffer_t *device2host = usb_dwc3_cdc_get_ringbuffer(dev, endpoint_number);
     if (!device2host)
         return;
 
-    size_t len =
-        ringbuffer_read(dev->endpoints[endpoint_number].xfer_buffer, XFER_SIZE, device2host);
+    usb_dwc3_cdc_stage_bulk_in_xfer(dev, endpoint_number, device2host);
 
-    if (!len && !dev->endpoints[endpoint_number].zlp_pending)
+    if (dev->endpoints[endpoint_number].xfer_in_progress ||
+        !dev->endpoints[endpoint_number].staged)
         return;
 
-    trb_iova = usb_dwc3_init_trb(dev, endpoint_number, &trb);
-    trb->ctrl |= DWC3_TRBCTL_NORMAL;
-    trb->size = DWC3_TRB_SIZE_LENGTH(len);
+    u32 len = dev->endpoints[endpoint_number].staged_len;
+    dev->endpoints[endpoint_number].staged = false;
+
+    usb_dwc3_bulk_start_transfer(dev, endpoint_number,
+                                 (dev->endpoints[endpoint_number].xfer_idx + 1) %
+                                     XFER_BUFFERS_PER_EP,
+                                 len);
+    dev->endpoints[endpoint_number].zlp_pending = len && (len % BULK_MAX_PACKET) == 0;
 
-    usb_dwc3_ep_start_transfer(dev, endpoint_number, trb_iova);
-    dev->endpoints[endpoint_number].xfer_in_progress = true;
-    dev->endpoints[endpoint_number].zlp_pending = (len % 512) == 0;
+    /* fill the other buffer while this transfer is in flight */
+    usb_dwc3_cdc_stage_bulk_in_xfer(dev, endpoint_number, device2host);
 }
 
 static void usb_dwc3_cdc_handle_bulk_out_xfer_done(dwc3_dev_t *dev,
                                                    const struct dwc3_event_depevt event)
 {
-    ringbuffer_t *host2device = usb_dwc3_cdc_get_ringbuffer(dev, event.endpoint_number);
+    u8 ep = event.endpoint_number;
+    ringbuffer_t *host2device = usb_dwc3_cdc_get_ringbuffer(dev, ep);
     if (!host2device)
         return;
-    size_t len = min(XFER_SIZE, ringbuffer_get_free(host2device));
-    ringbuffer_write(dev->endpoints[event.endpoint_number].xfer_buffer,
-                     len - dev->endpoints[event.endpoint_number].trb->size, host2device);
+
+    u8 idx = dev->endpoints[ep].xfer_idx;
+    if (idx == DIRECT_TRB_IDX)
+        return; // usb_dwc3_read_direct() picks up the result
+
+    size_t len = XFER_SIZE - DWC3_TRB_SIZE_LENGTH(dev->endpoints[ep].trb[idx].size);
+
+    /* re-arm the other buffer first so the host can keep sending while we copy */
+    if (!dev->endpoints[ep].direct && ringbuffer_get_free(host2device) >= len + XFER_SIZE)
+        usb_dwc3_bulk_start_transfer(dev, ep, (idx + 1) % XFER_BUFFERS_PER_EP, XFER_SIZE);
+
+    ringbuffer_write(usb_dwc3_bulk_buffer(dev, ep, idx), len, host2device);
 }
 
 static void usb_dwc3_handle_event_ep(dwc3_dev_t *dev, const struct dwc3_event_depevt event)
@@ -974,11 +1158,13 @@ static void usb_dwc3_handle_event_ep(dwc3_dev_t *dev, const struct dwc3_event_de
             case USB_LEP_CDC_INTR_IN: // [[fallthrough]]
             case USB_LEP_CDC_INTR_IN_2:
                 return;
-            case USB_LEP_CDC_BULK_IN: // [[fallthrough]]
-            case USB_LEP_CDC_BULK_IN_2:
-                return;
-            case USB_LEP_CDC_BULK_OUT: // [[fallthrough]]
-            case USB_LEP_CDC_BULK_OUT_2:
+            case USB_LEP_CDC_BULK_IN:   // [[fallthrough]]
+            case USB_LEP_CDC_BULK_IN_2: // [[fallthrough]]
+            case USB_LEP_VENDOR_BULK_IN:
+                return usb_dwc3_cdc_start_bulk_in_xfer(dev, event.endpoint_number);
+            case USB_LEP_CDC_BULK_OUT:   // [[fallthrough]]
+            case USB_LEP_CDC_BULK_OUT_2: // [[fallthrough]]
+            case USB_LEP_VENDOR_BULK_OUT:
                 return usb_dwc3_cdc_handle_bulk_out_xfer_done(dev, event);
         }
     } else if (event.endpoint_event == DWC3_DEPEVT_XFERNOTREADY) {
@@ -996,11 +1182,13 @@ static void usb_dwc3_handle_event_ep(dwc3_dev_t *dev, const struct dwc3_event_de
             case USB_LEP_CDC_INTR_IN: // [[fallthrough]]
             case USB_LEP_CDC_INTR_IN_2:
                 return;
-            case USB_LEP_CDC_BULK_IN: // [[fallthrough]]
-            case USB_LEP_CDC_BULK_IN_2:
+            case USB_LEP_CDC_BULK_IN:   // [[fallthrough]]
+            case USB_LEP_CDC_BULK_IN_2: // [[fallthrough]]
+            case USB_LEP_VENDOR_BULK_IN:
                 return usb_dwc3_cdc_start_bulk_in_xfer(dev, event.endpoint_number);
-            case USB_LEP_CDC_BULK_OUT: // [[fallthrough]]
-            case USB_LEP_CDC_BULK_OUT_2:
+            case USB_LEP_CDC_BULK_OUT:   // [[fallthrough]]
+            case USB_LEP_CDC_BULK_OUT_2: // [[fallthrough]]
+            case USB_LEP_VENDOR_BULK_OUT:
                 return usb_dwc3_cdc_start_bulk_out_xfer(dev, event.endpoint_number);
         }
     }
@@ -1017,6 +1205,10 @@ static void usb_dwc3_handle_event_usbrst(dwc3_dev_t *dev)
     dev->endpoints[0].xfer_in_progress = false;
     for (int i = 1; i < MAX_ENDPOINTS; ++i) {
         dev->endpoints[i].xfer_in_progress = false;
+        dev->endpoints[i].zlp_pending = false;
+        dev->endpoints[i].staged = false;
+        dev->endpoints[i].direct = false;
+        dev->endpoints[i].xfer_idx = 0;
         memset(dev->endpoints[i].xfer_buffer, 0, XFER_BUFFER_BYTES_PER_EP);
         memset(dev->endpoints[i].trb, 0, TRBS_PER_EP * sizeof(struct dwc3_trb));
         usb_dwc3_ep_set_stall(dev, i, 0);
@@ -1224,6 +1416,10 @@ dwc3_dev_t *usb_dwc3_init(uintptr_t regs, dart_dev_t *dart)
     dev->pipe[CDC_ACM_PIPE_1].ep_in = USB_LEP_CDC_BULK_IN_2;
     dev->pipe[CDC_ACM_PIPE_1].ep_out = USB_LEP_CDC_BULK_OUT_2;
 
+    /* the vendor interface has no notification endpoint */
+    dev->pipe[USB_VENDOR_PIPE].ep_in = USB_LEP_VENDOR_BULK_IN;
+    dev->pipe[USB_VENDOR_PIPE].ep_out = USB_LEP_VENDOR_BULK_OUT;
+
     for (int i = 0; i < CDC_ACM_PIPE_MAX; i++) {
         dev->pipe[i].host2device = ringbuffer_alloc(CDC_BUFFER_SIZE);
         if (!dev->pipe[i].host2device)
@@ -1233,7 +1429,8 @@ dwc3_dev_t *usb_dwc3_init(uintptr_t regs, dart_dev_t *dart)
             goto error;
 
         /* prepare INTR endpoint so that we don't have to reconfigure this device later */
-        if (usb_dwc3_ep_configure(dev, dev->pipe[i].ep_intr, DWC3_DEPCMD_TYPE_INTR, 64))
+        if (dev->pipe[i].ep_intr &&
+            usb_dwc3_ep_configure(dev, dev->pipe[i].ep_intr, DWC3_DEPCMD_TYPE_INTR, 64))
             goto error;
 
         /* prepare BULK endpoints so that we don't have to reconfigure this device later */
@@ -1405,6 +1602,111 @@ size_t usb_dwc3_read(dwc3_dev_t *dev, cdc_acm_pipe_id_t pipe, void *buf, size_t
     return recvd;
 }
 
+size_t usb_dwc3_read_direct(dwc3_dev_t *dev, cdc_acm_pipe_id_t pipe, void *buf, size_t count)
+{
+    u8 *p = buf;
+    size_t read, recvd = 0;
+
+    if (count < DIRECT_MIN_SIZE)
+        return usb_dwc3_read(dev, pipe, buf, count);
+
+    if (!dev || !dev->pipe[pipe].ready)
+        return 0;
+
+    ringbuffer_t *host2device = dev->pipe[pipe].host2device;
+    if (!host2device)
+        return 0;
+
+    u8 ep = dev->pipe[pipe].ep_out;
+
+    /* stop arming the transfer buffers and drain whatever the host already sent */
+    dev->endpoints[ep].direct = true;
+    while (count && (ringbuffer_get_used(host2device) || dev->endpoints[ep].xfer_in_progress)) {
+        read = ringbuffer_read(p, count, host2device);
+        count -= read;
+        p += read;
+        recvd += read;
+        usb_dwc3_handle_events(dev);
+    }
+    u8 xfer_idx = dev->endpoints[ep].xfer_idx;
+
+    /* OUT transfers must be a multiple of the packet size, the tail is bounced below */
+    while (count >= BULK_MAX_PACKET && dev->pipe[pipe].ready) {
+        u32 len = min(ALIGN_DOWN(count, BULK_MAX_PACKET), DIRECT_XFER_SIZE);
+        ssize_t ret = usb_dwc3_bulk_direct_xfer(dev, ep, (uintptr_t)p, len);
+        /* a zero length packet would leave this loop spinning, let usb_dwc3_read() handle it */
+        if (ret <= 0)
+            break;
+
+        /* a short packet just ends this transfer early, keep going */
+        count -= ret;
+        p += ret;
+        recvd += ret;
+    }
+
+    dev->endpoints[ep].xfer_idx = xfer_idx;
+    dev->endpoints[ep].direct = false;
+    usb_dwc3_cdc_start_bulk_out_xfer(dev, ep);
+
+    if (count)
+        recvd += usb_dwc3_read(dev, pipe, p, count);
+
+    return recvd;
+}
+
+size_t usb_dwc3_write_direct(dwc3_dev_t *dev, cdc_acm_pipe_id_t pipe, const void *buf,
+                             size_t count)
+{
+    const u8 *p = buf;
+    size_t sent = 0;
+
+    if (count < DIRECT_MIN_SIZE)
+        return usb_dwc3_queue(dev, pipe, buf, count);
+
+    if (!dev || !dev->pipe[pipe].ready)
+        return 0;
+
+    u8 ep = dev->pipe[pipe].ep_in;
+
+    /* everything queued so far has to go out first */
+    usb_dwc3_flush(dev, pipe);
+
+    u8 xfer_idx = dev->endpoints[ep].xfer_idx;
+    dev->endpoints[ep].direct = true;
+
+    while (count && dev->pipe[pipe].ready) {
+        u32 len = min(count, DIRECT_XFER_SIZE);
+        ssize_t ret = usb_dwc3_bulk_direct_xfer(dev, ep, (uintptr_t)p, len);
+        if (ret <= 0)
+            break;
+
+        count -= ret;
+        p += ret;
+        sent += ret;
+        dev->endpoints[ep].zlp_pending = ret && (ret % BULK_MAX_PACKET) == 0;
+    }
+
+    dev->endpoints[ep].xfer_idx = xfer_idx;
+    dev->endpoints[ep].direct = false;
+
+    if (count)
+        sent += usb_dwc3_queue(dev, pipe, p, count);
+
+    return sent;
+}
+
+/*
+ * The proxy pipe is the vendor interface while a libusb host has it open, and the first
+ * CDC-ACM pipe otherwise.
+ */
+cdc_acm_pipe_id_t usb_dwc3_proxy_pipe(dwc3_dev_t *dev)
+{
+    if (dev && dev->pipe[USB_VENDOR_PIPE].ready)
+        return USB_VENDOR_PIPE;
+
+    return CDC_ACM_PIPE_0;
+}
+
 ssize_t usb_dwc3_can_read(dwc3_dev_t *dev, cdc_acm_pipe_id_t pipe)
 {
     if (!dev || !dev->pipe[pipe].ready)
@@ -1437,7 +1739,9 @@ void usb_dwc3_flush(dwc3_dev_t *dev, cdc_acm_pipe_id_t pipe)
 
     u8 ep = dev->pipe[pipe].ep_in;
 
-    while (ringbuffer_get_used(device2host) != 0 || dev->endpoints[ep].xfer_in_progress) {
+    while (ringbuffer_get_used(device2host) != 0 || dev->endpoints[ep].xfer_in_progress ||
+           dev->endpoints[ep].staged) {
         usb_dwc3_handle_events(dev);
+        usb_dwc3_cdc_start_bulk_in_xfer(dev, ep);
     }
 }
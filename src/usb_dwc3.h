@@ -11,6 +11,8 @@ typedef struct dwc3_dev dwc3_dev_t;
 typedef enum _cdc_acm_pipe_id_t {
     CDC_ACM_PIPE_0,
     CDC_ACM_PIPE_1,
+    /* vendor-class bulk interface, libusb hosts use it in place of CDC_ACM_PIPE_0 */
+    USB_VENDOR_PIPE,
     CDC_ACM_PIPE_MAX
 } cdc_acm_pipe_id_t;
 
@@ -19,6 +21,8 @@ void usb_dwc3_shutdown(dwc3_dev_t *dev);
 
 void usb_dwc3_handle_events(dwc3_dev_t *dev);
 
+cdc_acm_pipe_id_t usb_dwc3_proxy_pipe(dwc3_dev_t *dev);
+
 ssize_t usb_dwc3_can_read(dwc3_dev_t *dev, cdc_acm_pipe_id_t pipe);
 bool usb_dwc3_can_write(dwc3_dev_t *dev, cdc_acm_pipe_id_t pipe);
 
@@ -30,4 +34,8 @@ size_t usb_dwc3_write(dwc3_dev_t *dev, cdc_acm_pipe_id_t pipe, const void *buf,
 size_t usb_dwc3_queue(dwc3_dev_t *dev, cdc_acm_pipe_id_t pipe, const void *buf, size_t count);
 void usb_dwc3_flush(dwc3_dev_t *dev, cdc_acm_pipe_id_t pipe);
 
+size_t usb_dwc3_read_direct(dwc3_dev_t *dev, cdc_acm_pipe_id_t pipe, void *buf, size_t count);
+size_t usb_dwc3_write_direct(dwc3_dev_t *dev, cdc_acm_pipe_id_t pipe, const void *buf,
+                             size_t count);
+
 #endif
@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+"""Host benchmark for the payload decoders in src/ (tinf, minilzlib and lz4).
+
+The decoders are built as a host shared library and fed the given corpora (ideally a kernel Image
+and an initramfs), compressed with Python's gzip and lzma modules and, if installed, the lz4 command
+line tool (frame and legacy format). Their output is checked byte-for-byte against the original
+data before timing is reported.
+"""
+import ctypes, gzip, lzma, os, pathlib, shutil, struct, subprocess, sys, tempfile
+
+ROOT = pathlib.Path(__file__).resolve().parents[1]
+SRC = ROOT / "src"
+sys.path.append(str(ROOT / "proxyclient"))
+
+from m1n1 import bench
+
+# Minimal stand-ins for the m1n1 headers the decoders pull in
+SHIMS = {
+    "utils.h": """
+#include <stdio.h>
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+""",
+    "string.h": "#include <string.h>\n",
+    "smp.h": """
+#include "types.h"
+#define MAX_CPUS 1
+static inline int smp_id(void)
+{
+    return 0;
+}
+typedef void (*smp_work_fn_t)(void *arg, u64 start, u64 end);
+static inline int smp_parallel_for(u64 start, u64 end, u64 grain, smp_work_fn_t fn, void *arg)
+{
+    (void)grain;
+    fn(arg, start, end);
+    return 1;
+}
+""",
+}
+
+SOURCES = [
+    "tinf/adler32.c", "tinf/crc32.c", "tinf/tinfgzip.c", "tinf/tinflate.c", "tinf/tinfzlib.c",
+    "minilzlib/dictbuf.c", "minilzlib/inputbuf.c", "minilzlib/lzma2dec.c",
+    "minilzlib/lzmadec.c", "minilzlib/rangedec.c", "minilzlib/xzstream.c",
+    "lz4.c",
+]
+
+def build(workdir, cc, cflags):
+    src = workdir / "src"
+    for d in ("tinf", "minilzlib"):
+        shutil.copytree(SRC / d, src / d)
+    for f in ("lz4.c", "lz4.h", "types.h"):
+        shutil.copy(SRC / f, src / f)
+    for name, body in SHIMS.items():
+        (src / name).write_text(body)
+
+    lib = workdir / "libdecomp.so"
+    cmd = [cc, "-shared", "-fPIC", *cflags.split(), "-iquote", str(src), "-o", str(lib)]
+    cmd += [str(src / s) for s in SOURCES]
+    subprocess.check_call(cmd)
+
+    dll = ctypes.CDLL(str(lib))
+    dll.tinf_init()
+    return dll
+
+def compress(data, workdir):
+    out = {
+        "gz": gzip.compress(data, 9),
+        "xz": lzma.compress(data, format=lzma.FORMAT_XZ, check=lzma.CHECK_CRC32),
+    }
+    if shutil.which("lz4"):
+        raw = workdir / "corpus"
+        raw.write_bytes(data)
+        subprocess.check_call(["lz4", "-q", "-f", "-9", str(raw), str(raw) + ".lz4"])
+        out["lz4"] = (workdir / "corpus.lz4").read_bytes()
+        # Legacy format, with the size trailer Linux appends to Image.lz4
+        subprocess.check_call(["lz4", "-q", "-f", "-l", "-9", str(raw), str(raw) + ".lz4l"])
+        out["lz4l"] = (workdir / "corpus.lz4l").read_bytes() + struct.pack("<I", len(data))
+    else:
+        print("  (lz4 tool not found, skipping LZ4)")
+    return out
+
+def decode(dll, fmt, comp, outbuf):
+    src = ctypes.create_string_buffer(comp, len(comp))
+    if fmt == "gz":
+        dlen, slen = ctypes.c_uint(len(outbuf)), ctypes.c_uint(len(comp))
+        ok = dll.tinf_gzip_uncompress(outbuf, ctypes.byref(dlen), src, ctypes.byref(slen)) == 0
+    elif fmt == "xz":
+        dlen, slen = ctypes.c_uint32(len(outbuf)), ctypes.c_uint32(len(comp))
+        ok = bool(dll.XzDecode(src, ctypes.byref(slen), outbuf, ctypes.byref(dlen)) & 0xff)
+    else:
+        dlen, slen = ctypes.c_size_t(len(outbuf)), ctypes.c_size_t(len(comp))
+        ok = dll.lz4_decompress(outbuf, ctypes.byref(dlen), src, ctypes.byref(slen)) == 0
+    return ok, dlen.value
+
+def bench_corpus(dll, name, data, workdir, runs, ghz):
+    print(f"{name}: {len(data)} bytes")
+    outbuf = ctypes.create_string_buffer(len(data) + 4096)
+
+    for fmt, comp in compress(data, workdir).items():
+        ok, size = decode(dll, fmt, comp, outbuf)
+        if not ok or outbuf.raw[:size] != data:
+            print(f"  {fmt:4s} MISMATCH against reference output (ok={ok}, {size} bytes)")
+            continue
+
+        best = bench.best_of(runs, decode, dll, fmt, comp, outbuf)
+
+        line = f"  {fmt:4s} {len(comp):10d} -> {size:10d}  {size / best / 1e6:8.1f} MB/s"
+        if ghz:
+            line += f"  {size / (best * ghz * 1e9):6.3f} B/cycle"
+        print(line)
+
+parser = bench.parser(__doc__.splitlines()[0], "runs", 5, "timed runs per format (best is kept)")
+parser.add_argument("corpus", nargs="*", type=pathlib.Path,
+                    help="files to compress and decode (e.g. a kernel Image and an initramfs)")
+parser.add_argument("--ghz", type=float, help="host core clock, to also report bytes/cycle")
+parser.add_argument("--cc", default=os.environ.get("CC", "cc"))
+parser.add_argument("--cflags", default="-O2 -Wno-multichar")
+args = parser.parse_args()
+
+with tempfile.TemporaryDirectory() as tmp:
+    workdir = pathlib.Path(tmp)
+    dll = build(workdir, args.cc, args.cflags)
+
+    corpora = [(str(f), f.read_bytes()) for f in args.corpus]
+    if not corpora:
+        print("No corpus given, using the m1n1 sources as a stand-in")
+        corpora = [("src/*.c", b"".join(f.read_bytes() for f in sorted(SRC.glob("*.c"))))]
+
+    for name, data in corpora:
+        bench_corpus(dll, name, data, workdir, args.runs, args.ghz)
@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: MIT */
+
+/* Host stand-in for src/fb.h */
+
+#ifndef FB_H
+#define FB_H
+
+#include "types.h"
+
+/* There is no framebuffer console in the simulator */
+static inline bool fb_console_pending(void)
+{
+    return false;
+}
+
+#endif
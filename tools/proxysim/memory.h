@@ -0,0 +1,13 @@
+/* SPDX-License-Identifier: MIT */
+
+/* Host stand-in for src/memory.h */
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include "types.h"
+#include "utils.h"
+
+extern uint64_t ram_base;
+
+#endif
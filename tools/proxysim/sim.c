@@ -0,0 +1,640 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Host-side loopback simulator for the m1n1 proxy protocol.
+ *
+ * src/uartproxy.c is built unmodified against the host shims in this directory and served over a
+ * pty, so the proxyclient stack can be exercised without a Mac. Device memory is a sparse,
+ * demand-zero mapping covering the usual RAM and MMIO ranges at their real addresses. The proxy
+ * ops that only touch memory are implemented here (the rest reply S_BADCMD), and an optional
+ * generator emits MMIO or IRQ trace events at a fixed rate while the proxy waits for requests.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "exception.h"
+#include "iodev.h"
+#include "memory.h"
+#include "proxy.h"
+#include "string.h"
+#include "uartproxy.h"
+#include "xnuboot.h"
+
+// Everything in [4GiB, 1TiB) is simulated memory: MMIO blocks and DRAM alike
+#define SIM_SPACE_BASE 0x100000000UL
+#define SIM_SPACE_END  0x10000000000UL
+#define SIM_RAM_BASE   0x800000000UL
+#define SIM_VIRT_BASE  0xfffffe0010000000UL
+
+#define SIM_BOOTARGS_OFF 0x4000
+#define SIM_ADT_OFF      0x10000
+#define SIM_M1N1_OFF     0x10000000
+#define SIM_HEAP_OFF     0x11000000
+#define SIM_FB_SIZE      0x2000000
+
+#define GUARD_MARK_VALUE 0xacce5515abad1dea
+#define ESR_DABORT       0x96000010 // Data abort, same EL, synchronous external abort
+
+#define SIM_TX_MAX 65536
+
+u64 ram_base = SIM_RAM_BASE;
+struct boot_args cur_boot_args;
+u64 boot_args_addr;
+
+volatile enum exc_guard_t exc_guard = GUARD_OFF;
+volatile int exc_count = 0;
+volatile u64 exc_last_esr = 0;
+volatile u64 exc_last_far = 0;
+
+static int sim_fd = -1;
+static u8 sim_tx[SIM_TX_MAX];
+static size_t sim_tx_len;
+
+static u64 sim_base;
+static u64 sim_heap;
+
+static u32 evt_rate;
+static u16 evt_type = EVT_MMIOTRACE;
+static bool evt_armed;
+static u64 evt_sent;
+static u64 evt_start_ns;
+
+static u64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void sim_events(void)
+{
+    if (!evt_rate || !evt_armed)
+        return;
+
+    u64 due = (now_ns() - evt_start_ns) * evt_rate / 1000000000UL;
+    // Catch up in bounded bursts so that requests still get through under an overload
+    for (int i = 0; evt_sent < due && i < 64; i++, evt_sent++) {
+        if (evt_type == EVT_IRQTRACE) {
+            struct {
+                u32 flags;
+                u16 type;
+                u16 num;
+            } evt = {1, 1, evt_sent & 0x3ff};
+            uartproxy_send_event(EVT_IRQTRACE, &evt, sizeof(evt));
+        } else {
+            struct {
+                u32 flags;
+                u32 reserved;
+                u64 pc;
+                u64 addr;
+                u64 data;
+            } evt = {
+                .flags = 2 | ((evt_sent & 1) << 5), // 32-bit, alternating reads and writes
+                .pc = SIM_VIRT_BASE + 0x1000 + 4 * (evt_sent & 0xff),
+                .addr = 0x235000000 + 4 * (evt_sent & 0xfff),
+                .data = evt_sent,
+            };
+            uartproxy_send_event(EVT_MMIOTRACE, &evt, sizeof(evt));
+        }
+    }
+}
+
+static void sim_tx_flush(void)
+{
+    size_t off = 0;
+
+    while (off < sim_tx_len) {
+        ssize_t ret = write(sim_fd, sim_tx + off, sim_tx_len - off);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                struct pollfd pfd = {sim_fd, POLLOUT, 0};
+                poll(&pfd, 1, 10);
+                continue;
+            }
+            perror("proxysim: write");
+            exit(1);
+        }
+        off += ret;
+    }
+    sim_tx_len = 0;
+}
+
+static void sim_tx_queue(const void *buf, size_t length)
+{
+    while (length) {
+        size_t chunk = min(length, SIM_TX_MAX - sim_tx_len);
+        memcpy(sim_tx + sim_tx_len, buf, chunk);
+        sim_tx_len += chunk;
+        buf = (const u8 *)buf + chunk;
+        length -= chunk;
+        if (sim_tx_len == SIM_TX_MAX)
+            sim_tx_flush();
+    }
+}
+
+static bool sim_wait_readable(int timeout_ms)
+{
+    struct pollfd pfd = {sim_fd, POLLIN, 0};
+
+    return poll(&pfd, 1, timeout_ms) > 0 && (pfd.revents & POLLIN);
+}
+
+/* iodev API, backed by the pty for IODEV_UART */
+
+iodev_usage_t iodev_get_usage(iodev_id_t id)
+{
+    return id == IODEV_UART ? USAGE_UARTPROXY : 0;
+}
+
+void iodev_handle_events(iodev_id_t id)
+{
+    if (id == IODEV_UART)
+        sim_events();
+}
+
+ssize_t iodev_can_read(iodev_id_t id)
+{
+    if (id != IODEV_UART)
+        return 0;
+
+    // The startup loop polls, so block for a little while here instead of spinning
+    return sim_wait_readable(1);
+}
+
+ssize_t iodev_read(iodev_id_t id, void *buf, size_t length)
+{
+    size_t done = 0;
+
+    if (id != IODEV_UART)
+        return -1;
+
+    while (done < length) {
+        if (!sim_wait_readable(1)) {
+            sim_events();
+            continue;
+        }
+
+        ssize_t ret = read(sim_fd, (u8 *)buf + done, length - done);
+        if (ret < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (ret <= 0)
+            return done;
+        done += ret;
+        if (!evt_armed) {
+            // Only start the event stream once a host is talking to us
+            evt_armed = true;
+            evt_start_ns = now_ns();
+        }
+    }
+
+    return done;
+}
+
+ssize_t iodev_queue(iodev_id_t id, const void *buf, size_t length)
+{
+    if (id != IODEV_UART)
+        return -1;
+
+    sim_tx_queue(buf, length);
+    return length;
+}
+
+ssize_t iodev_write(iodev_id_t id, const void *buf, size_t length)
+{
+    if (id != IODEV_UART)
+        return -1;
+
+    sim_tx_queue(buf, length);
+    sim_tx_flush();
+    return length;
+}
+
+ssize_t iodev_read_direct(iodev_id_t id, void *buf, size_t length)
+{
+    return iodev_read(id, buf, length);
+}
+
+ssize_t iodev_write_direct(iodev_id_t id, const void *buf, size_t length)
+{
+    return iodev_queue(id, buf, length);
+}
+
+void iodev_flush(iodev_id_t id)
+{
+    if (id == IODEV_UART)
+        sim_tx_flush();
+}
+
+void iodev_lock(iodev_id_t id)
+{
+    UNUSED(id);
+}
+
+void iodev_unlock(iodev_id_t id)
+{
+    UNUSED(id);
+}
+
+/* Guarded memory access, emulating the exception guard for addresses outside the map */
+
+static bool sim_mapped(u64 addr, u64 size)
+{
+    return addr >= SIM_SPACE_BASE && addr < SIM_SPACE_END && size <= SIM_SPACE_END - addr;
+}
+
+static bool sim_check(u64 addr, u64 size)
+{
+    if (sim_mapped(addr, size))
+        return true;
+
+    exc_count++;
+    exc_last_esr = ESR_DABORT;
+    exc_last_far = addr;
+    if (!(exc_guard & GUARD_SILENT))
+        printf("proxysim: data abort at 0x%lx\n", addr);
+    return false;
+}
+
+static u64 sim_read(u64 addr, int size)
+{
+    if (!sim_check(addr, size))
+        return GUARD_MARK_VALUE;
+
+    switch (size) {
+        case 8:
+            return *(volatile u64 *)addr;
+        case 4:
+            return *(volatile u32 *)addr;
+        case 2:
+            return *(volatile u16 *)addr;
+        default:
+            return *(volatile u8 *)addr;
+    }
+}
+
+static void sim_write(u64 addr, u64 val, int size)
+{
+    if (!sim_check(addr, size))
+        return;
+
+    switch (size) {
+        case 8:
+            *(volatile u64 *)addr = val;
+            break;
+        case 4:
+            *(volatile u32 *)addr = val;
+            break;
+        case 2:
+            *(volatile u16 *)addr = val;
+            break;
+        default:
+            *(volatile u8 *)addr = val;
+            break;
+    }
+}
+
+static void sim_memset(u64 dst, u64 val, u64 size, int width)
+{
+    if (!sim_check(dst, size))
+        return;
+
+    for (u64 off = 0; off + width <= size; off += width)
+        sim_write(dst + off, val, width);
+}
+
+static u64 sim_memdiff32(u64 src, u64 snap, u64 size, u64 out, u64 out_size)
+{
+    u64 max = out_size / 8;
+    u64 changed = 0;
+    int count = exc_count;
+
+    // Faults are reported in the return value only, like in src/proxy.c
+    if (!sim_check(src, size) || !sim_check(snap, size) || !sim_check(out, out_size)) {
+        exc_count = count;
+        return ~0UL;
+    }
+
+    for (u64 i = 0; i < size / 4; i++) {
+        u32 val = sim_read(src + 4 * i, 4);
+        if (val == sim_read(snap + 4 * i, 4))
+            continue;
+
+        sim_write(snap + 4 * i, val, 4);
+        if (changed < max) {
+            sim_write(out + 8 * changed, 4 * i, 4);
+            sim_write(out + 8 * changed + 4, val, 4);
+        }
+        changed++;
+    }
+
+    return changed;
+}
+
+static u64 sim_alloc(u64 size, u64 align)
+{
+    u64 block = ALIGN_UP(sim_heap, align);
+
+    sim_heap = block + size;
+    return block;
+}
+
+int proxy_process(ProxyRequest *request, ProxyReply *reply)
+{
+    enum exc_guard_t guard_save = exc_guard;
+    u64 *args = request->args;
+
+    reply->opcode = request->opcode;
+    reply->status = S_OK;
+    reply->retval = 0;
+    switch (request->opcode) {
+        case P_NOP:
+            break;
+        case P_EXIT:
+            return args[0] ? args[0] : 1;
+        case P_GET_BOOTARGS:
+            reply->retval = boot_args_addr;
+            break;
+        case P_GET_BASE:
+            reply->retval = sim_base;
+            break;
+        case P_SET_BAUD:
+            break;
+        case P_UDELAY:
+            usleep(args[0]);
+            break;
+        case P_SET_EXC_GUARD:
+            exc_count = 0;
+            guard_save = args[0];
+            break;
+        case P_GET_EXC_COUNT:
+            reply->retval = exc_count;
+            exc_count = 0;
+            break;
+
+        case P_WRITE64 ... P_WRITE8:
+            exc_guard = GUARD_SKIP;
+            sim_write(args[0], args[1], 8 >> (request->opcode - P_WRITE64));
+            break;
+        case P_READ64 ... P_READ8:
+            exc_guard = GUARD_MARK;
+            reply->retval = sim_read(args[0], 8 >> (request->opcode - P_READ64));
+            break;
+        case P_SET64 ... P_SET8: {
+            int size = 8 >> (request->opcode - P_SET64);
+            exc_guard = GUARD_MARK;
+            reply->retval = sim_read(args[0], size) | args[1];
+            sim_write(args[0], reply->retval, size);
+            break;
+        }
+        case P_CLEAR64 ... P_CLEAR8: {
+            int size = 8 >> (request->opcode - P_CLEAR64);
+            exc_guard = GUARD_MARK;
+            reply->retval = sim_read(args[0], size) & ~args[1];
+            sim_write(args[0], reply->retval, size);
+            break;
+        }
+        case P_MASK64 ... P_MASK8: {
+            int size = 8 >> (request->opcode - P_MASK64);
+            exc_guard = GUARD_MARK;
+            reply->retval = (sim_read(args[0], size) & ~args[1]) | args[2];
+            sim_write(args[0], reply->retval, size);
+            break;
+        }
+        case P_WRITEREAD64 ... P_WRITEREAD8: {
+            int size = 8 >> (request->opcode - P_WRITEREAD64);
+            exc_guard = GUARD_MARK;
+            sim_write(args[0], args[1], size);
+            reply->retval = sim_read(args[0], size);
+            break;
+        }
+
+        case P_MEMCPY64 ... P_MEMCPY8:
+            exc_guard = GUARD_RETURN;
+            if (sim_check(args[0], args[2]) && sim_check(args[1], args[2]))
+                memmove((void *)args[0], (void *)args[1], args[2]);
+            break;
+        case P_MEMSET64 ... P_MEMSET8:
+            exc_guard = GUARD_RETURN;
+            sim_memset(args[0], args[1], args[2], 8 >> (request->opcode - P_MEMSET64));
+            break;
+        case P_MEMZERO:
+            exc_guard = GUARD_RETURN;
+            sim_memset(args[0], 0, args[1], 1);
+            break;
+        case P_MEMDIFF32:
+            exc_guard = GUARD_MARK | GUARD_SILENT;
+            reply->retval = sim_memdiff32(args[0], args[1], args[2], args[3], args[4]);
+            break;
+
+        case P_IC_IALLUIS ... P_DC_CIVAC:
+            break;
+
+        case P_HEAPBLOCK_ALLOC:
+            reply->retval = sim_alloc(args[0], 64);
+            break;
+        case P_MALLOC:
+            reply->retval = sim_alloc(args[0], 64);
+            break;
+        case P_MEMALIGN:
+            reply->retval = sim_alloc(args[1], args[0] ? args[0] : 64);
+            break;
+        case P_FREE:
+            break;
+
+        case P_IODEV_WHOAMI:
+            reply->retval = uartproxy_iodev;
+            break;
+
+        default:
+            reply->status = S_BADCMD;
+            break;
+    }
+    exc_guard = guard_save;
+
+    return 0;
+}
+
+/* Device setup */
+
+static u8 *adt_prop(u8 *p, const char *name, const void *value, u32 size)
+{
+    memset(p, 0, 32);
+    strncpy((char *)p, name, 32);
+    memcpy(p + 32, &size, 4);
+    memcpy(p + 36, value, size);
+    return p + ALIGN_UP(36 + size, 4);
+}
+
+// A two-node ADT, just enough to identify the device: root (with a serial number) and /chosen
+static u32 sim_build_adt(u8 *adt, const char *serial)
+{
+    u8 *p = adt;
+    u32 hdr[2];
+    u8 seed[32];
+
+    for (size_t i = 0; i < sizeof(seed); i++)
+        seed[i] = rand();
+
+    hdr[0] = 3;
+    hdr[1] = 1;
+    memcpy(p, hdr, 8);
+    p = adt_prop(p + 8, "name", "device-tree", 12);
+    p = adt_prop(p, "compatible", "m1n1,proxysim", 14);
+    p = adt_prop(p, "serial-number", serial, strlen(serial) + 1);
+
+    hdr[0] = 2;
+    hdr[1] = 0;
+    memcpy(p, hdr, 8);
+    p = adt_prop(p + 8, "name", "chosen", 7);
+    p = adt_prop(p, "random-seed", seed, sizeof(seed));
+
+    return p - adt;
+}
+
+static void sim_setup_memory(u64 mem_size, const char *serial)
+{
+    void *space = mmap((void *)SIM_SPACE_BASE, SIM_SPACE_END - SIM_SPACE_BASE,
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+    if (space != (void *)SIM_SPACE_BASE) {
+        perror("proxysim: cannot map the simulated address space");
+        exit(1);
+    }
+
+    struct boot_args *ba = (void *)(SIM_RAM_BASE + SIM_BOOTARGS_OFF);
+    u8 *adt = (void *)(SIM_RAM_BASE + SIM_ADT_OFF);
+
+    ba->revision = 2;
+    ba->version = 2;
+    ba->virt_base = SIM_VIRT_BASE;
+    ba->phys_base = SIM_RAM_BASE;
+    ba->mem_size = mem_size - SIM_FB_SIZE;
+    ba->mem_size_actual = mem_size;
+    ba->top_of_kernel_data = SIM_RAM_BASE + SIM_HEAP_OFF;
+    ba->video.base = SIM_RAM_BASE + mem_size - SIM_FB_SIZE;
+    ba->video.width = 1920;
+    ba->video.height = 1080;
+    ba->video.stride = 1920 * 4;
+    ba->video.depth = 30;
+    ba->machine_type = 0;
+    ba->devtree = (void *)(SIM_VIRT_BASE + SIM_ADT_OFF);
+    ba->devtree_size = ALIGN_UP(sim_build_adt(adt, serial), SZ_16K);
+    strcpy(ba->cmdline, "proxysim");
+
+    cur_boot_args = *ba;
+    boot_args_addr = (u64)ba;
+    sim_base = SIM_RAM_BASE + SIM_M1N1_OFF;
+    sim_heap = SIM_RAM_BASE + SIM_HEAP_OFF;
+}
+
+static void sim_segv(int sig, siginfo_t *info, void *ctx)
+{
+    UNUSED(sig);
+    UNUSED(ctx);
+    fprintf(stderr, "proxysim: access to %p is outside the simulated address space\n",
+            info->si_addr);
+    _exit(1);
+}
+
+static int sim_open_pty(const char *link)
+{
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) || unlockpt(fd)) {
+        perror("proxysim: posix_openpt");
+        exit(1);
+    }
+
+    // Keep the slave open ourselves: the host may come and go, and the line stays raw
+    const char *name = ptsname(fd);
+    int slave = open(name, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (slave < 0 || tcgetattr(slave, &tio)) {
+        perror("proxysim: pty slave");
+        exit(1);
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    if (link) {
+        unlink(link);
+        if (symlink(name, link)) {
+            perror("proxysim: symlink");
+            exit(1);
+        }
+    }
+
+    printf("%s\n", link ? link : name);
+    fflush(stdout);
+    return fd;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [-l link] [-m mem_mib] [-s serial] [-r events_per_sec] [-t mmio|irq]\n",
+            argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *link = NULL;
+    const char *serial = "SIM0000000";
+    u64 mem_size = 8UL << 30;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:m:s:r:t:")) != -1) {
+        switch (opt) {
+            case 'l':
+                link = optarg;
+                break;
+            case 'm':
+                mem_size = strtoull(optarg, NULL, 0) << 20;
+                break;
+            case 's':
+                serial = optarg;
+                break;
+            case 'r':
+                evt_rate = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                if (!strcmp(optarg, "irq"))
+                    evt_type = EVT_IRQTRACE;
+                else if (strcmp(optarg, "mmio"))
+                    usage(argv[0]);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (mem_size < SIM_HEAP_OFF + SIM_FB_SIZE + (2UL << 30)) {
+        fprintf(stderr, "proxysim: need at least %lu MiB of memory\n",
+                (SIM_HEAP_OFF + SIM_FB_SIZE + (2UL << 30)) >> 20);
+        return 2;
+    }
+
+    struct sigaction sa = {.sa_sigaction = sim_segv, .sa_flags = SA_SIGINFO};
+    sigaction(SIGSEGV, &sa, NULL);
+
+    srand(time(NULL));
+    sim_setup_memory(mem_size, serial);
+    sim_fd = sim_open_pty(link);
+
+    int ret = uartproxy_run(NULL);
+
+    if (link)
+        unlink(link);
+    return ret < 0 ? 1 : 0;
+}
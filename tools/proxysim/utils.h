@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: MIT */
+
+/* Host stand-in for src/utils.h, with just what uartproxy.c and the simulator use. */
+
+#ifndef UTILS_H
+#define UTILS_H
+
+#include <stdio.h>
+
+#include "types.h"
+
+#define BIT(x) (1UL << (x))
+
+#define ALIGN_UP(x, a) (((x) + ((a)-1)) & ~((a)-1))
+
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+
+#define sysop(op) __asm__ volatile("" ::: "memory")
+
+typedef struct {
+    int lock;
+} spinlock_t;
+
+static inline void write8(u64 addr, u8 data)
+{
+    *(volatile u8 *)addr = data;
+}
+
+#endif